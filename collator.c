@@ -1,7 +1,14 @@
 #include "icu_common.h"
+#include <errno.h>
 extern VALUE rb_cUString;
 extern VALUE rb_cUCollator;
+extern VALUE rb_cUCollatorIndex;
+extern VALUE rb_cUReader;
 extern int icu_collator_cmp (UCollator * collator, VALUE str1, VALUE str2) ;
+extern VALUE icu_from_rstr(int argc, VALUE * argv, VALUE str);
+extern void icu_parallel_for(void *(*fn)(void *), void * items, size_t item_size, int n);
+extern UConverter * icu_cnv_checkout(const char * name, UErrorCode * status);
+extern void icu_cnv_checkin(const char * name, UConverter * cnv);
 
 /**
  * Document-class: UCollator
@@ -59,15 +66,114 @@ extern int icu_collator_cmp (UCollator * collator, VALUE str1, VALUE str2) ;
  *      UCOL_UPPER_FIRST       upper case sorts before lower case
  **/
 
-#define UCOLLATOR(obj) ((UCollator *)DATA_PTR(obj))
+typedef struct {
+    UCollator * col;
+    char      * image;	/* binary image for UCollator.from_binary, must outlive col */
+} ICUCollator;
+
+#define UCOLLATOR(obj) (((ICUCollator *)DATA_PTR(obj))->col)
+
+/* --------- cache of opened collators, keyed by locale and attributes */
+#define COL_CACHE_SIZE 16
+typedef struct {
+    char                 locale[ULOC_FULLNAME_CAPACITY];
+    UColAttributeValue   attrs[UCOL_ATTRIBUTE_COUNT];
+    UCollator          * col;
+} ICUCollatorSlot;
+
+static ICUCollatorSlot s_col_cache[COL_CACHE_SIZE];
+static int s_col_cache_next = 0;
+
+/**
+ * Fills +attrs+ with UCOL_DEFAULT, i.e. locale defaults.
+ */
+void icu_col_attrs_init(UColAttributeValue * attrs)
+{
+    int i;
+    for( i = 0; i < UCOL_ATTRIBUTE_COUNT; i++) attrs[i] = UCOL_DEFAULT;
+}
+
+/* NULL locale means default one, which may change at runtime */
+static const char * icu_col_key(const char * locale)
+{
+    return locale ? locale : uloc_getDefault();
+}
+
+/**
+ * Takes collator for +locale+ with +attrs+ (UCOL_ATTRIBUTE_COUNT values, UCOL_DEFAULT 
+ * for not changed ones) out of the cache, or opens a new one.
+ * Must be returned with icu_col_checkin, and may not be modified or shared while checked out.
+ */
+UCollator * icu_col_checkout(const char * locale, const UColAttributeValue * attrs, UErrorCode * status)
+{
+    int i;
+    UCollator * col;
+    const char * key = icu_col_key(locale);
+    for( i = 0; i < COL_CACHE_SIZE; i++) {
+       if( s_col_cache[i].col && !strcmp(s_col_cache[i].locale, key) 
+           && !memcmp(s_col_cache[i].attrs, attrs, sizeof(s_col_cache[i].attrs)) ) {
+          col = s_col_cache[i].col;
+          s_col_cache[i].col = NULL;
+          return col;
+       }
+    }
+    col = ucol_open(locale, status);
+    for( i = 0; i < UCOL_ATTRIBUTE_COUNT && U_SUCCESS(*status); i++) {
+       if( attrs[i] != UCOL_DEFAULT ) ucol_setAttribute(col, i, attrs[i], status);
+    }
+    if( U_FAILURE(*status) ) {
+       ucol_close(col);
+       return NULL;
+    }
+    return col;
+}
+
+/**
+ * Returns collator, obtained by icu_col_checkout(locale, attrs), to the cache.
+ * When cache is full, the oldest entry is closed.
+ */
+void icu_col_checkin(const char * locale, const UColAttributeValue * attrs, UCollator * col)
+{
+    int i, slot = -1;
+    const char * key = icu_col_key(locale);
+    if( !col ) return;
+    if( strlen(key) >= ULOC_FULLNAME_CAPACITY ) {
+       ucol_close(col);
+       return;
+    }
+    for( i = 0; i < COL_CACHE_SIZE; i++) {
+       if( !s_col_cache[i].col ) { slot = i; break; }
+    }
+    if( slot == -1 ) {
+       slot = s_col_cache_next;
+       s_col_cache_next = (s_col_cache_next + 1) % COL_CACHE_SIZE;
+       ucol_close(s_col_cache[slot].col);
+    }
+    strcpy(s_col_cache[slot].locale, key);
+    memcpy(s_col_cache[slot].attrs, attrs, sizeof(s_col_cache[slot].attrs));
+    s_col_cache[slot].col = col;
+}
  
-void icu4r_col_free(UCollator * col)
+static UCollator   * s_root_col = NULL;
+
+void icu4r_col_free(ICUCollator * c)
+{
+    if( c->col ) ucol_close(c->col);
+    free(c->image);
+    free(c);
+}
+
+static VALUE icu4r_col_wrap(VALUE klass, UCollator * col, char * image)
 {
-    ucol_close(col);
+    ICUCollator * c = ALLOC(ICUCollator);
+    c->col = col;
+    c->image = image;
+    return Data_Wrap_Struct(klass, 0, icu4r_col_free, c);
 }
+
 static VALUE icu4r_col_alloc(VALUE klass)
 {
-    return Data_Wrap_Struct(klass, 0, icu4r_col_free, 0);
+    return icu4r_col_wrap(klass, NULL, NULL);
 }
 /**
  * call-seq:
@@ -90,10 +196,101 @@ VALUE icu4r_col_init(int argc, VALUE * argv, VALUE self)
     }
     col = ucol_open(locale,  &status);
     ICU_RAISE(status);
-    DATA_PTR(self)=col;
+    UCOLLATOR(self)=col;
     return self;
 }
 
+/**
+ * call-seq:
+ *     UCollator.from_rules(rules) -> collator
+ *
+ * Creates collator from tailoring +rules+ (UString or UTF-8 String), applied to UCA.
+ * Building collator from rules is slow, see UCollator#to_binary to do it once.
+ *
+ *     col = UCollator.from_rules("&a < c < b")
+ */
+VALUE icu4r_col_from_rules(VALUE klass, VALUE rules)
+{
+    UCollator * col;
+    UParseError pe;
+    UErrorCode status = U_ZERO_ERROR;
+    if( TYPE(rules) == T_STRING ) rules = icu_from_rstr(0, NULL, rules);
+    Check_Class(rules, rb_cUString);
+    col = ucol_openRules(ICU_PTR(rules), ICU_LEN(rules), UCOL_DEFAULT, UCOL_DEFAULT_STRENGTH, &pe, &status);
+    if( U_FAILURE(status) ) 
+       rb_raise(rb_eArgError, "Wrong rules: %s line %d column %d", u_errorName(status), pe.line, pe.offset);
+    return icu4r_col_wrap(klass, col, NULL);
+}
+
+/**
+ * call-seq:
+ *     collator.to_binary -> String
+ *
+ * Returns binary image of collator tailoring and attributes, which UCollator.from_binary 
+ * loads much faster, than collator is built from rules. Image is valid only for the same 
+ * ICU version.
+ *
+ *     File.open("names.col", "wb") { |f| f.write(UCollator.from_rules(rules).to_binary) }
+ */
+VALUE icu4r_col_to_binary(VALUE self)
+{
+    UErrorCode status = U_ZERO_ERROR;
+    int32_t len;
+    char * p;
+    int i;
+    VALUE ret;
+    len = ucol_cloneBinary(UCOLLATOR(self), NULL, 0, &status);
+    if( status != U_BUFFER_OVERFLOW_ERROR ) ICU_RAISE(status);
+    status = U_ZERO_ERROR;
+    /* ICU before 53 doesn't store attributes in image: append them, then their count */
+    ret = rb_str_new(0, len + UCOL_ATTRIBUTE_COUNT + 1);
+    p = RSTRING(ret)->ptr;
+    ucol_cloneBinary(UCOLLATOR(self), (uint8_t *) p, len, &status);
+    for( i = 0; i < UCOL_ATTRIBUTE_COUNT; i++) {
+       p[len + i] = (char) ucol_getAttribute(UCOLLATOR(self), (UColAttribute) i, &status);
+    }
+    p[len + UCOL_ATTRIBUTE_COUNT] = UCOL_ATTRIBUTE_COUNT;
+    ICU_RAISE(status);
+    return ret;
+}
+
+/**
+ * call-seq:
+ *     UCollator.from_binary(str) -> collator
+ *
+ * Opens collator from image, returned by UCollator#to_binary.
+ *
+ *     col = UCollator.from_binary(File.open("names.col", "rb") { |f| f.read })
+ */
+VALUE icu4r_col_from_binary(VALUE klass, VALUE bin)
+{
+    UCollator * col;
+    UErrorCode status = U_ZERO_ERROR;
+    char * image;
+    VALUE ret;
+    long len, n, i;
+    Check_Type(bin, T_STRING);
+    len = RSTRING(bin)->len;
+    n = len > 0 ? (unsigned char) RSTRING(bin)->ptr[len - 1] : 0;
+    if( len < n + 2 ) rb_raise(rb_eArgError, "Wrong collator image");
+    len -= n + 1;
+    if( !s_root_col ) {
+       s_root_col = ucol_open("", &status);
+       ICU_RAISE(status);
+    }
+    image = ALLOC_N(char, len);
+    MEMCPY(image, RSTRING(bin)->ptr, char, len);
+    ret = icu4r_col_wrap(klass, NULL, image);
+    col = ucol_openBinary((uint8_t *) image, len, s_root_col, &status);
+    if( U_FAILURE(status) ) rb_raise(rb_eArgError, "Wrong collator image: %s", u_errorName(status));
+    UCOLLATOR(ret) = col;
+    for( i = 0; i < n && i < UCOL_ATTRIBUTE_COUNT; i++) {
+       ucol_setAttribute(col, (UColAttribute) i, (UColAttributeValue) (signed char) RSTRING(bin)->ptr[len + i], &status);
+    }
+    ICU_RAISE(status);
+    return ret;
+}
+
 /**
  * call-seq:
  *     collator.strength 
@@ -151,31 +348,90 @@ VALUE icu4r_col_set_attr(VALUE self, VALUE obj, VALUE new_val)
     ICU_RAISE(status);
     return Qnil;
 }
+/* checks that +str+ is UString, or UTF-8 String, which UCharIterator can walk */
+static void icu_col_check_str(VALUE str)
+{
+    if( TYPE(str) == T_STRING ) {
+       if( RSTRING(str)->len > INT32_MAX ) rb_raise(rb_eArgError, "String is too long");
+    } else {
+       Check_Class(str, rb_cUString);
+    }
+}
+
+/* sets +it+ to walk UString or UTF-8 String, checked by icu_col_check_str */
+static void icu_col_iter(UCharIterator * it, VALUE str)
+{
+    if( TYPE(str) == T_STRING ) uiter_setUTF8(it, RSTRING(str)->ptr, RSTRING(str)->len);
+    else uiter_setString(it, ICU_PTR(str), ICU_LEN(str));
+}
+
 /**
  * call-seq:
- *     collator.strcoll(ustr1, ustr2)
+ *     collator.strcoll(str1, str2)
  *
  * Compare two UString's. The strings will be compared using the options already specified.
+ * UTF-8 Strings are accepted too, and compared without conversion by iterating over their
+ * characters; comparison stops at the first primary difference, so only a prefix of long 
+ * strings is usually read.
  **/
 VALUE icu4r_col_strcoll(VALUE self, VALUE str1, VALUE str2)
 {
-    Check_Class(str1, rb_cUString);
-    Check_Class(str2, rb_cUString);
-    return INT2FIX(icu_collator_cmp(UCOLLATOR(self), str1,  str2));
+    UErrorCode status = U_ZERO_ERROR;
+    UCharIterator it1, it2;
+    UCollationResult r;
+    icu_col_check_str(str1);
+    icu_col_check_str(str2);
+    if( TYPE(str1) != T_STRING && TYPE(str2) != T_STRING )
+       return INT2FIX(icu_collator_cmp(UCOLLATOR(self), str1,  str2));
+#if U_ICU_VERSION_MAJOR_NUM >= 50
+    if( TYPE(str1) == T_STRING && TYPE(str2) == T_STRING ) {
+       r = ucol_strcollUTF8(UCOLLATOR(self), RSTRING(str1)->ptr, RSTRING(str1)->len, 
+                            RSTRING(str2)->ptr, RSTRING(str2)->len, &status);
+       ICU_RAISE(status);
+       return INT2FIX(r);
+    }
+#endif
+    icu_col_iter(&it1, str1);
+    icu_col_iter(&it2, str2);
+    r = ucol_strcollIter(UCOLLATOR(self), &it1, &it2, &status);
+    ICU_RAISE(status);
+    return INT2FIX(r);
 }
+/* sort keys are about this many bytes per code unit */
+#define SORT_KEY_ESTIMATE(len) (3 * (len) + 16)
+
 /**
  * call-seq:
  *     collator.sort_key(an_ustring) -> String
+ *     collator.sort_key(an_ustring, bytes) -> String
  *
  * Get a sort key for a string from a UCollator. Sort keys may be compared using strcmp.
+ * With +bytes+, returns only first +bytes+ bytes of key, generated incrementally: 
+ * such partial keys are comparable with partial keys only.
  **/
-VALUE icu4r_col_sort_key(VALUE self, VALUE str)
+VALUE icu4r_col_sort_key(int argc, VALUE * argv, VALUE self)
 {
     int32_t needed , capa ;
     char * buffer ; 
-    VALUE ret;
+    VALUE ret, str, bytes;
+    UCharIterator iter;
+    uint32_t state[2] = { 0, 0 };
+    UErrorCode status = U_ZERO_ERROR;
+    rb_scan_args(argc, argv, "11", &str, &bytes);
     Check_Class(str, rb_cUString);
-    capa = ICU_LEN(str);
+    if( !NIL_P(bytes) ) {
+      capa = NUM2INT(bytes);
+      if( capa < 0 ) rb_raise(rb_eArgError, "Negative length: %d", capa);
+      buffer = ALLOC_N(char, capa + 1);
+      uiter_setString(&iter, ICU_PTR(str), ICU_LEN(str));
+      needed = ucol_nextSortKeyPart(UCOLLATOR(self), &iter, state, (uint8_t *) buffer, capa, &status);
+      if( U_FAILURE(status) ) free(buffer);
+      ICU_RAISE(status);
+      ret = rb_str_new(buffer, needed);
+      free(buffer);
+      return ret;
+    }
+    capa = SORT_KEY_ESTIMATE(ICU_LEN(str));
     buffer = ALLOC_N(char, capa);
     needed = ucol_getSortKey(UCOLLATOR(self), ICU_PTR(str), ICU_LEN(str), buffer, capa);
     if(needed > capa){
@@ -186,12 +442,1564 @@ VALUE icu4r_col_sort_key(VALUE self, VALUE str)
     free(buffer);
     return ret;
 }
+/* --------- sorting by sort keys */
+typedef struct {
+    char   * buf;
+    long     size, used;
+} ICUKeyArena;
+
+typedef struct {
+    const char * key;
+    long         idx;
+} ICUSortEntry;
+
+/**
+ * Appends sort key of +s+ to arena, growing it as needed. Returns offset of
+ * the key, or -1 when out of memory. Doesn't touch Ruby objects.
+ */
+long icu_col_key_append(const UCollator * col, const UChar * s, int32_t len, ICUKeyArena * a)
+{
+    int32_t need;
+    long avail = a->size - a->used, size;
+    char * buf;
+    need = ucol_getSortKey(col, s, len, (uint8_t *) a->buf + a->used, avail > INT32_MAX ? INT32_MAX : avail);
+    if( need > avail ) {
+       size = a->size * 2 > a->used + need ? a->size * 2 : a->used + need;
+       buf = realloc(a->buf, size);
+       if( !buf ) return -1;
+       a->buf = buf;
+       a->size = size;
+       need = ucol_getSortKey(col, s, len, (uint8_t *) a->buf + a->used, need);
+    }
+    a->used += need;
+    return a->used - need;
+}
+
+/* orders by key, then by position, so sorting is stable */
+int icu_sort_entry_cmp(const void * p1, const void * p2)
+{
+    const ICUSortEntry * e1 = (const ICUSortEntry *) p1, * e2 = (const ICUSortEntry *) p2;
+    int r = strcmp(e1->key, e2->key);
+    if( r ) return r;
+    return e1->idx < e2->idx ? -1 : e1->idx > e2->idx;
+}
+
+/* returns +v+ as UString, converting String from UTF-8 */
+static VALUE icu_col_ustr(VALUE v)
+{
+    if( TYPE(v) == T_STRING ) v = icu_from_rstr(0, NULL, v);
+    Check_Class(v, rb_cUString);
+    return v;
+}
+
+/**
+ * Computes sort keys of UStrings +keys+ into arena +a+, which is sized by estimate
+ * of total key length. Offsets of keys are stored in +off+ (+n+ + 1 entries).
+ */
+static void icu_col_keys(UCollator * col, VALUE keys, ICUKeyArena * a, long * off)
+{
+    long i, n = RARRAY(keys)->len;
+    VALUE * k = RARRAY(keys)->ptr;
+    a->size = 0;
+    for( i = 0; i < n; i++) a->size += SORT_KEY_ESTIMATE(ICU_LEN(k[i]));
+    a->used = 0;
+    a->buf = ALLOC_N(char, a->size + 1);
+    for( i = 0; i < n; i++) {
+       off[i] = icu_col_key_append(col, ICU_PTR(k[i]), ICU_LEN(k[i]), a);
+       if( off[i] < 0 ) {
+          free(a->buf);
+          a->buf = NULL;
+          free(off);
+          rb_memerror();
+       }
+    }
+    off[n] = a->used;
+}
+
+/* --------- parallel sort: partitions are keyed and sorted by own collator clones, then merged */
+#define SORT_MIN_PART 1024
+
+typedef struct {
+    UCollator      * col;
+    const UChar   ** str;
+    const int32_t  * len;
+    ICUSortEntry   * e;
+    long             from, to;
+    ICUKeyArena      a;
+    int              failed;
+} ICUSortPart;
+
+typedef struct {
+    ICUSortEntry   * src, * dst;
+    long             lo, mid, hi;
+} ICUMergeTask;
+
+typedef struct {
+    int              n;
+    ICUSortPart      part[ICU_MAX_THREADS];
+    ICUSortEntry   * e, * tmp;
+    int              ok;
+} ICUSortJob;
+
+static void * icu_sort_part(void * p)
+{
+    ICUSortPart * t = (ICUSortPart *) p;
+    long i, off;
+    t->a.size = 16;
+    for( i = t->from; i < t->to; i++) t->a.size += SORT_KEY_ESTIMATE(t->len[i]);
+    t->a.used = 0;
+    t->a.buf = malloc(t->a.size);
+    t->failed = !t->a.buf;
+    for( i = t->from; i < t->to && !t->failed; i++) {
+       off = icu_col_key_append(t->col, t->str[i], t->len[i], &t->a);
+       t->failed = off < 0;
+       t->e[i].key = (const char *) off;
+       t->e[i].idx = i;
+    }
+    if( t->failed ) return NULL;
+    for( i = t->from; i < t->to; i++) t->e[i].key = t->a.buf + (long) t->e[i].key;
+    qsort(t->e + t->from, t->to - t->from, sizeof(ICUSortEntry), icu_sort_entry_cmp);
+    return NULL;
+}
+
+static void * icu_merge_runs(void * p)
+{
+    ICUMergeTask * m = (ICUMergeTask *) p;
+    long i = m->lo, j = m->mid, k = m->lo;
+    while( i < m->mid && j < m->hi ) 
+       m->dst[k++] = icu_sort_entry_cmp(m->src + j, m->src + i) < 0 ? m->src[j++] : m->src[i++];
+    while( i < m->mid ) m->dst[k++] = m->src[i++];
+    while( j < m->hi ) m->dst[k++] = m->src[j++];
+    return NULL;
+}
+
+static VALUE icu_sort_job(ICUSortJob * j)
+{
+    ICUMergeTask task[ICU_MAX_THREADS];
+    long bound[ICU_MAX_THREADS + 1];
+    ICUSortEntry * t;
+    int runs, k, m;
+    icu_parallel_for(icu_sort_part, j->part, sizeof(ICUSortPart), j->n);
+    j->ok = 1;
+    for( k = 0; k < j->n; k++) {
+       if( j->part[k].failed ) j->ok = 0;
+       bound[k] = j->part[k].from;
+    }
+    if( !j->ok ) return Qnil;
+    runs = j->n;
+    bound[runs] = j->part[runs - 1].to;
+    /* merge pairs of neighbour runs, until one is left */
+    while( runs > 1 ) {
+       m = (runs + 1) / 2;
+       for( k = 0; k < m; k++) {
+          task[k].src = j->e;
+          task[k].dst = j->tmp;
+          task[k].lo  = bound[2 * k];
+          task[k].mid = bound[2 * k + 1];
+          task[k].hi  = bound[2 * k + 2 < runs ? 2 * k + 2 : runs];
+       }
+       icu_parallel_for(icu_merge_runs, task, sizeof(ICUMergeTask), m);
+       for( k = 0; k < m; k++) bound[k] = task[k].lo;
+       bound[m] = bound[runs];
+       runs = m;
+       t = j->e; j->e = j->tmp; j->tmp = t;
+    }
+    return Qnil;
+}
+
+/* sorts entries of +n+ UStrings +k+ in +threads+ threads */
+static ICUSortEntry * icu_col_sort_parallel(UCollator * col, VALUE * k, long n, int threads)
+{
+    ICUSortJob j;
+    UErrorCode status = U_ZERO_ERROR;
+    const UChar ** str;
+    int32_t * len, size;
+    long i, step;
+    int t;
+
+    if( threads > n / SORT_MIN_PART + 1 ) threads = n / SORT_MIN_PART + 1;
+    str = ALLOC_N(const UChar *, n);
+    len = ALLOC_N(int32_t, n);
+    for( i = 0; i < n; i++) {
+       str[i] = ICU_PTR(k[i]);
+       len[i] = ICU_LEN(k[i]);
+    }
+    j.n = threads;
+    j.e = ALLOC_N(ICUSortEntry, n + 1);
+    j.tmp = ALLOC_N(ICUSortEntry, n + 1);
+    step = n / threads;
+    for( t = 0; t < threads; t++) {
+       size = U_COL_SAFECLONE_BUFFERSIZE;
+       j.part[t].col = ucol_safeClone(col, NULL, &size, &status);
+       j.part[t].str = str;
+       j.part[t].len = len;
+       j.part[t].e = j.e;
+       j.part[t].from = t * step;
+       j.part[t].to = t == threads - 1 ? n : (t + 1) * step;
+       j.part[t].a.buf = NULL;
+    }
+    j.ok = 0;
+    /* interpreter lock is kept, so strings can't change meanwhile */
+    if( U_SUCCESS(status) ) icu_sort_job(&j);
+    for( t = 0; t < threads; t++) {
+       ucol_close(j.part[t].col);
+       free(j.part[t].a.buf);
+    }
+    free(str);
+    free(len);
+    free(j.tmp);
+    if( !j.ok ) {
+       free(j.e);
+       ICU_RAISE(status);
+       rb_memerror();
+    }
+    return j.e;
+}
+
+/**
+ * Returns elements of +ary+, ordered by sort keys of +keys+ (UStrings, one per element),
+ * using +threads+ threads.
+ */
+static VALUE icu_col_sort_ary(UCollator * col, VALUE ary, VALUE keys, int threads)
+{
+    ICUKeyArena a;
+    ICUSortEntry * e;
+    long i, n = RARRAY(keys)->len, * off;
+    VALUE ret;
+
+    a.buf = NULL;
+    if( threads > 1 && n >= 2 * SORT_MIN_PART ) {
+       e = icu_col_sort_parallel(col, RARRAY(keys)->ptr, n, threads);
+    } else {
+       off = ALLOC_N(long, n + 1);
+       icu_col_keys(col, keys, &a, off);
+       e = ALLOC_N(ICUSortEntry, n + 1);
+       for( i = 0; i < n; i++) {
+          e[i].key = a.buf + off[i];
+          e[i].idx = i;
+       }
+       free(off);
+       qsort(e, n, sizeof(ICUSortEntry), icu_sort_entry_cmp);
+    }
+    ret = rb_ary_new2(n);
+    for( i = 0; i < n; i++) rb_ary_push(ret, RARRAY(ary)->ptr[e[i].idx]);
+    free(a.buf);
+    free(e);
+    return ret;
+}
+
+/* reads :threads option */
+static int icu_col_threads(VALUE options)
+{
+    VALUE val;
+    if( NIL_P(options) ) return 1;
+    Check_Type(options, T_HASH);
+    val = rb_hash_aref(options, ID2SYM(rb_intern("threads")));
+    if( NIL_P(val) ) return 1;
+    Check_Type(val, T_FIXNUM);
+    if( FIX2INT(val) < 1 || FIX2INT(val) > ICU_MAX_THREADS )
+       rb_raise(rb_eArgError, "Thread count must be in 1..%d, got %d", ICU_MAX_THREADS, FIX2INT(val));
+    return FIX2INT(val);
+}
+
+/**
+ * call-seq:
+ *     collator.sort(array, options = {}) -> an_array
+ *
+ * Returns a new array with UStrings (or UTF-8 Strings) from +array+, sorted by this collator.
+ * Sort key of each string is computed once, and keys are sorted in C, what is much faster
+ * than <code>array.sort { |a, b| collator.strcoll(a, b) }</code>. Sort is stable.
+ *
+ * Option <tt>:threads</tt> sets number of threads to use for large arrays: each thread 
+ * keys and sorts part of array with own copy of collator, then parts are merged.
+ * Result is the same for any number of threads. UString.parallel_threads is a good value.
+ *
+ *     UCollator.new("sv").sort(["z".u, "ö".u, "a".u])    # => ["a", "z", "ö"]
+ *     col.sort(names, :threads => 4)
+ **/
+VALUE icu4r_col_sort(int argc, VALUE * argv, VALUE self)
+{
+    VALUE ary, options, keys;
+    long i;
+    rb_scan_args(argc, argv, "11", &ary, &options);
+    Check_Type(ary, T_ARRAY);
+    keys = rb_ary_new2(RARRAY(ary)->len);
+    for( i = 0; i < RARRAY(ary)->len; i++) rb_ary_push(keys, icu_col_ustr(RARRAY(ary)->ptr[i]));
+    return icu_col_sort_ary(UCOLLATOR(self), ary, keys, icu_col_threads(options));
+}
+
+/**
+ * call-seq:
+ *     collator.sort_by(array, options = {}) {|obj| block } -> an_array
+ *
+ * Returns a new array with elements of +array+, sorted by UStrings (or UTF-8 Strings)
+ * returned from the block. Block is called once per element. Sort is stable.
+ * Options are the same as for UCollator#sort.
+ *
+ *     col.sort_by(people) { |p| p.name }
+ **/
+VALUE icu4r_col_sort_by(int argc, VALUE * argv, VALUE self)
+{
+    VALUE ary, options, keys;
+    long i;
+    rb_scan_args(argc, argv, "11", &ary, &options);
+    Check_Type(ary, T_ARRAY);
+    ary = rb_ary_dup(ary);
+    keys = rb_ary_new2(RARRAY(ary)->len);
+    for( i = 0; i < RARRAY(ary)->len; i++) rb_ary_push(keys, icu_col_ustr(rb_yield(RARRAY(ary)->ptr[i])));
+    return icu_col_sort_ary(UCOLLATOR(self), ary, keys, icu_col_threads(options));
+}
+
+/**
+ * call-seq:
+ *     collator.sort_keys(array, options = {}) -> an_array
+ *
+ * Returns sort keys for all UStrings (or UTF-8 Strings) of +array+, as frozen Strings,
+ * same as collator.sort_key would return. Keys are computed in a single buffer.
+ * When option <tt>:packed</tt> is true, returns <code>[blob, offsets]</code> instead: 
+ * keys concatenated into one String, and Array of <code>array.size + 1</code> offsets, 
+ * key +i+ being <code>blob[offsets[i]...offsets[i+1]]</code>.
+ *
+ *     blob, offsets = col.sort_keys(names, :packed => true)
+ **/
+VALUE icu4r_col_sort_keys(int argc, VALUE * argv, VALUE self)
+{
+    ICUKeyArena a;
+    VALUE ary, options, keys, ret, offsets;
+    long i, n, * off;
+    int packed = 0;
+    rb_scan_args(argc, argv, "11", &ary, &options);
+    Check_Type(ary, T_ARRAY);
+    if( !NIL_P(options) ) {
+       Check_Type(options, T_HASH);
+       packed = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("packed"))));
+    }
+    n = RARRAY(ary)->len;
+    keys = rb_ary_new2(n);
+    for( i = 0; i < n; i++) rb_ary_push(keys, icu_col_ustr(RARRAY(ary)->ptr[i]));
+    off = ALLOC_N(long, n + 1);
+    icu_col_keys(UCOLLATOR(self), keys, &a, off);
+    if( packed ) {
+       offsets = rb_ary_new2(n + 1);
+       for( i = 0; i <= n; i++) rb_ary_push(offsets, LONG2NUM(off[i]));
+       ret = rb_ary_new3(2, rb_str_new(a.buf, a.used), offsets);
+    } else {
+       ret = rb_ary_new2(n);
+       for( i = 0; i < n; i++) rb_ary_push(ret, rb_obj_freeze(rb_str_new(a.buf + off[i], off[i+1] - off[i])));
+    }
+    free(a.buf);
+    free(off);
+    return ret;
+}
+
+/* --------- partial sort keys: bytes are generated only until strings are ordered */
+#define KEY_PART 16
+
+typedef struct {
+    UCharIterator  it;
+    uint32_t       state[2];
+    uint8_t      * key;
+    int32_t        len, capa;
+    int            done;	/* whole key is generated */
+    long           idx;
+} ICUPartKey;
+
+static void icu_part_key_set(ICUPartKey * p, VALUE str, long idx)
+{
+    icu_col_iter(&p->it, str);
+    p->state[0] = p->state[1] = 0;
+    p->len = 0;
+    p->done = 0;
+    p->idx = idx;
+}
+
+/* generates next bytes of key, doubling its length */
+static void icu_part_key_extend(const UCollator * col, ICUPartKey * p, UErrorCode * status)
+{
+    int32_t count = p->len > KEY_PART ? p->len : KEY_PART, got;
+    uint8_t * key;
+    if( p->len + count > p->capa ) {
+       key = realloc(p->key, p->len + count);
+       if( !key ) {
+          *status = U_MEMORY_ALLOCATION_ERROR;
+          return;
+       }
+       p->key = key;
+       p->capa = p->len + count;
+    }
+    got = ucol_nextSortKeyPart(col, &p->it, p->state, p->key + p->len, count, status);
+    /* short part means end of key; capa may be left from previous string */
+    p->done = got < count;
+    p->len += got;
+}
+
+/* compares keys of +a+ and +b+, extending them while generated parts are equal */
+static int icu_part_key_cmp(const UCollator * col, ICUPartKey * a, ICUPartKey * b, UErrorCode * status)
+{
+    int32_t eq = 0, n;
+    int r;
+    for(;;) {
+       n = a->len < b->len ? a->len : b->len;
+       r = memcmp(a->key + eq, b->key + eq, n - eq);
+       if( r ) return r;
+       eq = n;
+       if( a->len == n && !a->done ) icu_part_key_extend(col, a, status);
+       else if( b->len == n && !b->done ) icu_part_key_extend(col, b, status);
+       else break;
+       if( U_FAILURE(*status) ) return 0;
+    }
+    return a->len < b->len ? -1 : a->len > b->len;
+}
+
+/* orders by key, then by position */
+static int icu_part_entry_cmp(const UCollator * col, ICUPartKey * a, ICUPartKey * b, UErrorCode * status)
+{
+    int r = icu_part_key_cmp(col, a, b, status);
+    if( r ) return r;
+    return a->idx < b->idx ? -1 : a->idx > b->idx;
+}
+
+static void icu_part_keys_free(ICUPartKey * p, long n)
+{
+    long i;
+    for( i = 0; i < n; i++) free(p[i].key);
+    free(p);
+}
+
+/* returns strings to order elements of +*ary+ by: block results or elements themselves,
+ * UStrings or UTF-8 Strings, if +convert+ is false. If block is given, +*ary+ is replaced
+ * by its copy, which the block can't change */
+static VALUE icu_col_block_keys(VALUE * ary, int convert)
+{
+    VALUE keys, str;
+    long i;
+    Check_Type(*ary, T_ARRAY);
+    if( rb_block_given_p() ) *ary = rb_ary_dup(*ary);
+    keys = rb_ary_new2(RARRAY(*ary)->len);
+    for( i = 0; i < RARRAY(*ary)->len; i++) {
+       str = rb_block_given_p() ? rb_yield(RARRAY(*ary)->ptr[i]) : RARRAY(*ary)->ptr[i];
+       if( convert ) str = icu_col_ustr(str);
+       else icu_col_check_str(str);
+       rb_ary_push(keys, str);
+    }
+    return keys;
+}
+
+/* returns first element of +ary+ with minimal (+dir+ = 1) or maximal (-1) key */
+static VALUE icu_col_extreme(VALUE self, VALUE ary, int dir)
+{
+    UErrorCode status = U_ZERO_ERROR;
+    ICUPartKey * p, * best, * cand, * t;
+    VALUE keys = icu_col_block_keys(&ary, 0);
+    long i, n = RARRAY(keys)->len;
+    if( n == 0 ) return Qnil;
+    p = ALLOC_N(ICUPartKey, 2);
+    MEMZERO(p, ICUPartKey, 2);
+    best = p;
+    cand = p + 1;
+    icu_part_key_set(best, RARRAY(keys)->ptr[0], 0);
+    for( i = 1; i < n && U_SUCCESS(status); i++) {
+       icu_part_key_set(cand, RARRAY(keys)->ptr[i], i);
+       if( dir * icu_part_key_cmp(UCOLLATOR(self), cand, best, &status) < 0 ) {
+          t = best; best = cand; cand = t;
+       }
+    }
+    i = best->idx;
+    icu_part_keys_free(p, 2);
+    if( status == U_MEMORY_ALLOCATION_ERROR ) rb_memerror();
+    ICU_RAISE(status);
+    return RARRAY(ary)->ptr[i];
+}
+
+/**
+ * call-seq:
+ *     collator.min_by(array) -> obj
+ *     collator.min_by(array) {|obj| block } -> obj
+ *
+ * Returns first element of +array+ with the least UString (or UTF-8 String) in collation order:
+ * element itself, or result of the block. Sort keys are generated only as far as needed
+ * to tell strings apart, usually a few bytes; UTF-8 Strings are read without conversion.
+ * Returns nil for empty array.
+ *
+ *     col.min_by(people) { |p| p.name }
+ **/
+VALUE icu4r_col_min_by(VALUE self, VALUE ary)
+{
+    return icu_col_extreme(self, ary, 1);
+}
+
+/**
+ * call-seq:
+ *     collator.max_by(array) -> obj
+ *     collator.max_by(array) {|obj| block } -> obj
+ *
+ * Returns first element of +array+ with the greatest UString (or UTF-8 String) in 
+ * collation order. See UCollator#min_by.
+ **/
+VALUE icu4r_col_max_by(VALUE self, VALUE ary)
+{
+    return icu_col_extreme(self, ary, -1);
+}
+
+/* restores max-heap order from position +i+ down */
+static void icu_part_heap_down(const UCollator * col, ICUPartKey ** h, long n, long i, UErrorCode * status)
+{
+    ICUPartKey * t;
+    long c;
+    while( (c = 2 * i + 1) < n && U_SUCCESS(*status) ) {
+       if( c + 1 < n && icu_part_entry_cmp(col, h[c + 1], h[c], status) > 0 ) c++;
+       if( icu_part_entry_cmp(col, h[c], h[i], status) <= 0 ) break;
+       t = h[c]; h[c] = h[i]; h[i] = t;
+       i = c;
+    }
+}
+
+/**
+ * call-seq:
+ *     collator.top_k(array, k) -> an_array
+ *     collator.top_k(array, k) {|obj| block } -> an_array
+ *
+ * Returns first +k+ elements of +array+ in collation order of UStrings (or UTF-8 Strings):
+ * elements themselves or results of the block. Same as <code>collator.sort(array)[0, k]</code>
+ * or <code>collator.sort_by(array) { ... }[0, k]</code>, but only +k+ keys are kept, and keys
+ * are generated only as far as needed to compare strings.
+ *
+ *     col.top_k(words, 10)
+ **/
+VALUE icu4r_col_top_k(VALUE self, VALUE ary, VALUE k)
+{
+    UErrorCode status = U_ZERO_ERROR;
+    UCollator * col = UCOLLATOR(self);
+    ICUPartKey * p, ** h, * t;
+    VALUE keys, ret;
+    long i, j, n, m, cnt = NUM2LONG(k);
+
+    keys = icu_col_block_keys(&ary, 0);
+    n = RARRAY(keys)->len;
+    if( cnt < 0 ) rb_raise(rb_eArgError, "Negative count: %ld", cnt);
+    if( cnt > n ) cnt = n;
+    if( cnt == 0 ) return rb_ary_new();
+    p = ALLOC_N(ICUPartKey, cnt + 1);
+    MEMZERO(p, ICUPartKey, cnt + 1);
+    h = ALLOC_N(ICUPartKey *, cnt + 1);
+    for( i = 0; i <= cnt; i++) h[i] = p + i;
+    /* h[0..m) is max-heap of least elements seen, h[cnt] is scratch */
+    for( i = 0, m = 0; i < n && U_SUCCESS(status); i++) {
+       if( m < cnt ) {
+          icu_part_key_set(h[m], RARRAY(keys)->ptr[i], i);
+          m++;
+          if( m == cnt ) {
+             for( j = cnt / 2 - 1; j >= 0; j--) icu_part_heap_down(col, h, cnt, j, &status);
+          }
+          continue;
+       }
+       icu_part_key_set(h[cnt], RARRAY(keys)->ptr[i], i);
+       if( icu_part_entry_cmp(col, h[cnt], h[0], &status) < 0 ) {
+          t = h[0]; h[0] = h[cnt]; h[cnt] = t;
+          icu_part_heap_down(col, h, cnt, 0, &status);
+       }
+    }
+    /* pop greatest to the end */
+    for( m = cnt; m > 1 && U_SUCCESS(status); m--) {
+       t = h[0]; h[0] = h[m - 1]; h[m - 1] = t;
+       icu_part_heap_down(col, h, m - 1, 0, &status);
+    }
+    ret = rb_ary_new2(cnt);
+    if( U_SUCCESS(status) ) {
+       for( i = 0; i < cnt; i++) rb_ary_push(ret, RARRAY(ary)->ptr[h[i]->idx]);
+    }
+    icu_part_keys_free(p, cnt + 1);
+    free(h);
+    if( status == U_MEMORY_ALLOCATION_ERROR ) rb_memerror();
+    ICU_RAISE(status);
+    return ret;
+}
+
+/* --------- hashing by sort keys: strings equal by collator have equal keys */
+
+/* one-at-a-time hash of zero-terminated key, as UString#hash */
+static unsigned int icu_key_hash(const char * p)
+{
+    unsigned int key = 0;
+    while( *p ) {
+       key += (unsigned char) *p++;
+       key += (key << 10);
+       key ^= (key >> 6);
+    }
+    key += (key << 3);
+    key ^= (key >> 11);
+    key += (key << 15);
+    return key;
+}
+
+/**
+ * call-seq:
+ *     collator.hash_key(str) -> Fixnum
+ *
+ * Hash of UString (or UTF-8 String), consistent with collator equality at current strength and
+ * attributes: strings equal by <code>strcoll</code> have equal hash keys. Different strings may
+ * have equal hash keys too, use UCollator#sort_key to tell them apart.
+ *
+ *     col.strength = UCollator::UCOL_PRIMARY
+ *     col.hash_key("Jose") == col.hash_key("josé")  # => true
+ **/
+VALUE icu4r_col_hash_key(VALUE self, VALUE str)
+{
+    ICUKeyArena a;
+    unsigned int h;
+    str = icu_col_ustr(str);
+    a.buf = NULL;
+    a.size = a.used = 0;
+    if( icu_col_key_append(UCOLLATOR(self), ICU_PTR(str), ICU_LEN(str), &a) < 0 ) rb_memerror();
+    h = icu_key_hash(a.buf);
+    free(a.buf);
+    return INT2FIX(h & 0x3fffffff);
+}
+
+/**
+ * Splits UStrings +keys+ to classes of strings equal by collator, using hash table of
+ * their sort keys. Returns malloc'ed array of class numbers, in order of first appearance.
+ */
+static long * icu_col_classes(UCollator * col, VALUE keys, long * count)
+{
+    ICUKeyArena a;
+    long i, n = RARRAY(keys)->len, * off, * cls, * table, size, mask, h, c;
+    off = ALLOC_N(long, n + 1);
+    icu_col_keys(col, keys, &a, off);
+    for( size = 16; size < 2 * n; size *= 2);
+    mask = size - 1;
+    table = ALLOC_N(long, size);	/* first element of class + 1, 0 if empty */
+    MEMZERO(table, long, size);
+    cls = ALLOC_N(long, n + 1);
+    *count = 0;
+    for( i = 0; i < n; i++) {
+       for( h = icu_key_hash(a.buf + off[i]) & mask; table[h]; h = (h + 1) & mask) {
+          c = table[h] - 1;
+          if( !strcmp(a.buf + off[c], a.buf + off[i]) ) break;
+       }
+       if( table[h] ) {
+          cls[i] = cls[table[h] - 1];
+       } else {
+          table[h] = i + 1;
+          cls[i] = (*count)++;
+       }
+    }
+    free(table);
+    free(off);
+    free(a.buf);
+    return cls;
+}
+
+/**
+ * call-seq:
+ *     collator.uniq(array) -> an_array
+ *     collator.uniq(array) {|obj| block } -> an_array
+ *
+ * Returns new array with first of each group of elements, which are equal by collator:
+ * elements themselves, or results of the block (UStrings or UTF-8 Strings). Works in 
+ * linear time, hashing sort keys.
+ *
+ *     col.strength = UCollator::UCOL_PRIMARY
+ *     col.uniq(%w(Jose josé JOSE Ann))   # => ["Jose", "Ann"]
+ **/
+VALUE icu4r_col_uniq(VALUE self, VALUE ary)
+{
+    VALUE keys = icu_col_block_keys(&ary, 1), ret;
+    long i, n = RARRAY(keys)->len, count, * cls;
+    cls = icu_col_classes(UCOLLATOR(self), keys, &count);
+    ret = rb_ary_new2(count);
+    for( i = 0; i < n; i++) {
+       if( cls[i] == RARRAY(ret)->len ) rb_ary_push(ret, RARRAY(ary)->ptr[i]);
+    }
+    free(cls);
+    return ret;
+}
+
+/**
+ * call-seq:
+ *     collator.group_by(array) -> a_hash
+ *     collator.group_by(array) {|obj| block } -> a_hash
+ *
+ * Groups elements of +array+, which are equal by collator: elements themselves, or results
+ * of the block (UStrings or UTF-8 Strings). Returns hash, where key is the string of first 
+ * element of the group (block result, if block is given), and value is array of group elements
+ * in original order.
+ *
+ *     col.strength = UCollator::UCOL_PRIMARY
+ *     col.group_by(%w(Jose Ann josé))   # => {"Jose" => ["Jose", "josé"], "Ann" => ["Ann"]}
+ **/
+VALUE icu4r_col_group_by(VALUE self, VALUE ary)
+{
+    VALUE vals, keys, groups, ret;
+    long i, n, count, * cls;
+    Check_Type(ary, T_ARRAY);
+    vals = ary;
+    if( rb_block_given_p() ) {
+       ary = rb_ary_dup(ary);
+       n = RARRAY(ary)->len;
+       vals = rb_ary_new2(n);
+       for( i = 0; i < n; i++) rb_ary_push(vals, rb_yield(RARRAY(ary)->ptr[i]));
+    }
+    n = RARRAY(ary)->len;
+    keys = rb_ary_new2(n);
+    for( i = 0; i < n; i++) rb_ary_push(keys, icu_col_ustr(RARRAY(vals)->ptr[i]));
+    cls = icu_col_classes(UCOLLATOR(self), keys, &count);
+    groups = rb_ary_new2(count);
+    ret = rb_hash_new();
+    for( i = 0; i < n; i++) {
+       if( cls[i] == RARRAY(groups)->len ) {
+          rb_ary_push(groups, rb_ary_new());
+          rb_hash_aset(ret, RARRAY(vals)->ptr[i], RARRAY(groups)->ptr[cls[i]]);
+       }
+       rb_ary_push(RARRAY(groups)->ptr[cls[i]], RARRAY(ary)->ptr[i]);
+    }
+    free(cls);
+    return ret;
+}
+
+/* --------- k-way merge of sorted sources by sort keys */
+#define MERGE_ARRAY 0
+#define MERGE_NEXT  1	/* Enumerator#next, UReader#next */
+#define MERGE_GETS  2	/* IO#gets */
+
+typedef struct {
+    int           kind;
+    long          pos;		/* next element of array */
+    ICUKeyArena   key;		/* key of current item */
+} ICUMergeSource;
+
+typedef struct {
+    UCollator      * col;
+    VALUE            sources, items;
+    ICUMergeSource * src;
+    int            * heap;
+    int              n;
+} ICUMerge;
+
+static VALUE icu_merge_next(VALUE src)
+{
+    return rb_funcall(src, rb_intern("next"), 0);
+}
+
+static VALUE icu_merge_stop(VALUE src, VALUE err)
+{
+    return Qnil;
+}
+
+/* Enumerator (Enumerable::Enumerator in 1.8.7), or nil if it is not loaded */
+static VALUE icu_merge_enumerator(void)
+{
+    if( rb_const_defined(rb_cObject, rb_intern("Enumerator")) ) 
+       return rb_const_get(rb_cObject, rb_intern("Enumerator"));
+    if( rb_const_defined(rb_mEnumerable, rb_intern("Enumerator")) ) 
+       return rb_const_get(rb_mEnumerable, rb_intern("Enumerator"));
+    return Qnil;
+}
+
+/* kind of merge source, strings (which respond to next) are rejected */
+static int icu_merge_kind(VALUE src, VALUE enumerator)
+{
+    if( TYPE(src) == T_ARRAY ) return MERGE_ARRAY;
+    if( TYPE(src) == T_STRING || CLASS_OF(src) == rb_cUString ) 
+       rb_raise(rb_eTypeError, "String can't be merge source, wrap it in an Array");
+    if( rb_obj_is_kind_of(src, rb_cUReader) || (!NIL_P(enumerator) && rb_obj_is_kind_of(src, enumerator)) ) 
+       return MERGE_NEXT;
+    if( rb_obj_is_kind_of(src, rb_cIO) || rb_respond_to(src, rb_intern("gets")) ) return MERGE_GETS;
+    return -1;
+}
+
+/* reads next item of source +i+ and computes its key, returns 0 at the end */
+static int icu_merge_pull(ICUMerge * m, int i)
+{
+    ICUMergeSource * s = m->src + i;
+    VALUE src = RARRAY(m->sources)->ptr[i], item, str;
+    if( s->kind == MERGE_ARRAY ) {
+       if( s->pos >= RARRAY(src)->len ) return 0;
+       item = RARRAY(src)->ptr[s->pos++];
+    } else if( s->kind == MERGE_GETS ) {
+       item = rb_funcall(src, rb_intern("gets"), 0);
+    } else if( rb_const_defined(rb_cObject, rb_intern("StopIteration")) ) {
+       item = rb_rescue2(icu_merge_next, src, icu_merge_stop, src, rb_path2class("StopIteration"), 0);
+    } else {
+       item = icu_merge_next(src);
+    }
+    if( NIL_P(item) ) return 0;
+    rb_ary_store(m->items, i, item);
+    str = icu_col_ustr(item);
+    s->key.used = 0;
+    if( icu_col_key_append(m->col, ICU_PTR(str), ICU_LEN(str), &s->key) < 0 ) rb_memerror();
+    return 1;
+}
+
+/* orders sources by keys of current items, then by position */
+static int icu_merge_less(ICUMerge * m, int a, int b)
+{
+    int r = strcmp(m->src[a].key.buf, m->src[b].key.buf);
+    return r < 0 || (r == 0 && a < b);
+}
+
+static void icu_merge_down(ICUMerge * m, int i)
+{
+    int c, t;
+    while( (c = 2 * i + 1) < m->n ) {
+       if( c + 1 < m->n && icu_merge_less(m, m->heap[c + 1], m->heap[c]) ) c++;
+       if( !icu_merge_less(m, m->heap[c], m->heap[i]) ) break;
+       t = m->heap[c]; m->heap[c] = m->heap[i]; m->heap[i] = t;
+       i = c;
+    }
+}
+
+static VALUE icu_merge_run(VALUE arg)
+{
+    ICUMerge * m = (ICUMerge *) arg;
+    int i, k = RARRAY(m->sources)->len, top;
+    for( i = 0; i < k; i++) {
+       if( icu_merge_pull(m, i) ) m->heap[m->n++] = i;
+    }
+    for( i = m->n / 2 - 1; i >= 0; i--) icu_merge_down(m, i);
+    while( m->n > 0 ) {
+       top = m->heap[0];
+       rb_yield(RARRAY(m->items)->ptr[top]);
+       if( !icu_merge_pull(m, top) ) m->heap[0] = m->heap[--m->n];
+       icu_merge_down(m, 0);
+    }
+    return Qnil;
+}
+
+static VALUE icu_merge_done(VALUE arg)
+{
+    ICUMerge * m = (ICUMerge *) arg;
+    long i;
+    for( i = 0; i < RARRAY(m->sources)->len; i++) free(m->src[i].key.buf);
+    free(m->src);
+    free(m->heap);
+    return Qnil;
+}
+
+/**
+ * call-seq:
+ *     collator.merge(*sources) {|str| block } -> collator
+ *
+ * Merges +sources+, each sorted by this collator, and yields their UStrings (or UTF-8 Strings)
+ * in collation order. Items are read lazily, one from each source at a time, and their sort
+ * keys are computed once. Equal items are yielded in order of sources. 
+ *
+ * Source may be an Array, an Enumerator or UReader (read by +next+), an IO or other 
+ * object with +gets+ method, or other Enumerable, which is read by +to_a+. 
+ * String source raises TypeError.
+ *
+ *     runs = files.map { |f| File.open(f) }
+ *     col.merge(*runs) { |line| out << line }
+ **/
+VALUE icu4r_col_merge(int argc, VALUE * argv, VALUE self)
+{
+    ICUMerge m;
+    VALUE src, enumerator = icu_merge_enumerator();
+    int i;
+#ifdef RETURN_ENUMERATOR
+    RETURN_ENUMERATOR(self, argc, argv);
+#endif
+    m.col = UCOLLATOR(self);
+    m.sources = rb_ary_new4(argc, argv);
+    m.items = rb_ary_new2(argc);
+    for( i = 0; i < argc; i++) {
+       if( icu_merge_kind(argv[i], enumerator) < 0 ) 
+          rb_ary_store(m.sources, i, rb_convert_type(argv[i], T_ARRAY, "Array", "to_a"));
+    }
+    m.src = ALLOC_N(ICUMergeSource, argc + 1);
+    MEMZERO(m.src, ICUMergeSource, argc + 1);
+    for( i = 0; i < argc; i++) {
+       src = RARRAY(m.sources)->ptr[i];
+       m.src[i].kind = icu_merge_kind(src, enumerator);
+    }
+    m.heap = malloc((argc + 1) * sizeof(int));
+    m.n = 0;
+    if( !m.heap ) {
+       free(m.src);
+       rb_memerror();
+    }
+    rb_ensure(icu_merge_run, (VALUE) &m, icu_merge_done, (VALUE) &m);
+    return self;
+}
+
+/* --------- external sort: sorted runs of (key, line) records are spilled to temporary files */
+#define EXT_READ_SIZE  65536
+#define EXT_MAX_RUNS   64	/* more runs are merged into one, to limit open files */
+#define EXT_MIN_MEMORY 65536
+
+typedef struct {
+    uint32_t     klen;		/* key bytes */
+    uint32_t     tlen;		/* line code units */
+} ICUExtHeader;
+
+typedef struct {
+    FILE       * f;
+    ICUExtHeader h;
+    char       * buf;		/* key, then line */
+    size_t       capa;
+} ICUExtRun;
+
+typedef struct {
+    UCollator  * col;
+    UConverter * cnv;
+    const char * in_path, * out_path, * tmpdir;
+    long         limit;
+    FILE       * in, * out;
+    ICUExtRun    run[EXT_MAX_RUNS + 1];
+    int          runs;
+    ICUKeyArena  keys;
+    UChar      * text;		/* decoded text of current run */
+    long         text_len, text_capa;
+    long       * key_off, * line_off, * line_len, n, capa;
+    long         lines;		/* lines written */
+    UErrorCode   status;
+    int          err;		/* errno of failed file operation */
+    const char * err_path;
+} ICUExtSort;
+
+static int icu_ext_fail(ICUExtSort * j, const char * path)
+{
+    j->err = errno ? errno : EIO;
+    j->err_path = path;
+    return 0;
+}
+
+/* creates empty temporary file */
+static FILE * icu_ext_tmpfile(ICUExtSort * j)
+{
+    char * path;
+    FILE * f = NULL;
+    int fd;
+    if( !j->tmpdir ) return tmpfile();
+    path = malloc(strlen(j->tmpdir) + 32);
+    if( !path ) return NULL;
+    sprintf(path, "%s/icu4r_sortXXXXXX", j->tmpdir);
+    fd = mkstemp(path);
+    if( fd >= 0 ) {
+       unlink(path);
+       f = fdopen(fd, "w+b");
+       if( !f ) close(fd);
+    }
+    free(path);
+    return f;
+}
+
+/* encodes +len+ units of +s+ to output, flushing converter if +s+ is NULL */
+static int icu_ext_write(ICUExtSort * j, const UChar * s, long len)
+{
+    char buf[EXT_READ_SIZE], * target;
+    const UChar * end = s + len;
+    do {
+       j->status = U_ZERO_ERROR;
+       target = buf;
+       ucnv_fromUnicode(j->cnv, &target, buf + sizeof(buf), &s, end, NULL, s == NULL, &j->status);
+       if( target > buf && fwrite(buf, 1, target - buf, j->out) != (size_t)(target - buf) ) 
+          return icu_ext_fail(j, j->out_path);
+    } while( j->status == U_BUFFER_OVERFLOW_ERROR );
+    return U_SUCCESS(j->status);
+}
+
+static int icu_ext_write_line(ICUExtSort * j, const UChar * s, long len)
+{
+    static const UChar nl = 0x0A;
+    j->lines++;
+    return icu_ext_write(j, s, len) && icu_ext_write(j, &nl, 1);
+}
+
+/* reads next record of run, returns 0 at the end or on error */
+static int icu_ext_read(ICUExtSort * j, ICUExtRun * r)
+{
+    size_t size;
+    char * buf;
+    if( fread(&r->h, sizeof(ICUExtHeader), 1, r->f) != 1 ) {
+       if( ferror(r->f) ) icu_ext_fail(j, "temporary file");
+       return 0;
+    }
+    size = r->h.klen + r->h.tlen * sizeof(UChar);
+    if( size > r->capa ) {
+       buf = realloc(r->buf, size);
+       if( !buf ) {
+          j->status = U_MEMORY_ALLOCATION_ERROR;
+          return 0;
+       }
+       r->buf = buf;
+       r->capa = size;
+    }
+    if( fread(r->buf, 1, size, r->f) != size ) return icu_ext_fail(j, "temporary file");
+    return 1;
+}
+
+static int icu_ext_put(ICUExtSort * j, FILE * f, const char * key, const UChar * s, ICUExtHeader * h)
+{
+    if( fwrite(h, sizeof(ICUExtHeader), 1, f) != 1 || fwrite(key, 1, h->klen, f) != h->klen ||
+        fwrite(s, sizeof(UChar), h->tlen, f) != h->tlen ) return icu_ext_fail(j, "temporary file");
+    return 1;
+}
+
+/* orders runs by keys of current records, then by position */
+static int icu_ext_less(ICUExtSort * j, int a, int b)
+{
+    ICUExtRun * ra = j->run + a, * rb = j->run + b;
+    uint32_t n = ra->h.klen < rb->h.klen ? ra->h.klen : rb->h.klen;
+    int r = memcmp(ra->buf, rb->buf, n);
+    if( r == 0 ) r = ra->h.klen < rb->h.klen ? -1 : ra->h.klen > rb->h.klen;
+    return r < 0 || (r == 0 && a < b);
+}
+
+static void icu_ext_down(ICUExtSort * j, int * heap, int n, int i)
+{
+    int c, t;
+    while( (c = 2 * i + 1) < n ) {
+       if( c + 1 < n && icu_ext_less(j, heap[c + 1], heap[c]) ) c++;
+       if( !icu_ext_less(j, heap[c], heap[i]) ) break;
+       t = heap[c]; heap[c] = heap[i]; heap[i] = t;
+       i = c;
+    }
+}
+
+/* merges all runs to output, or to one new run when +to_run+ is set */
+static int icu_ext_merge(ICUExtSort * j, int to_run)
+{
+    int heap[EXT_MAX_RUNS + 1], n = 0, i, ok = 1;
+    ICUExtRun * r;
+    FILE * f = NULL;
+    if( to_run && !(f = icu_ext_tmpfile(j)) ) return icu_ext_fail(j, "temporary file");
+    for( i = 0; i < j->runs; i++) {
+       rewind(j->run[i].f);
+       if( icu_ext_read(j, j->run + i) ) heap[n++] = i;
+    }
+    if( j->err || U_FAILURE(j->status) ) ok = 0;
+    for( i = n / 2 - 1; i >= 0; i--) icu_ext_down(j, heap, n, i);
+    while( ok && n > 0 ) {
+       r = j->run + heap[0];
+       ok = to_run ? icu_ext_put(j, f, r->buf, (UChar *)(r->buf + r->h.klen), &r->h) 
+                   : icu_ext_write_line(j, (UChar *)(r->buf + r->h.klen), r->h.tlen);
+       if( ok && !icu_ext_read(j, r) ) {
+          ok = !j->err && U_SUCCESS(j->status);
+          heap[0] = heap[--n];
+       }
+       icu_ext_down(j, heap, n, 0);
+    }
+    for( i = 0; i < j->runs; i++) {
+       fclose(j->run[i].f);
+       j->run[i].f = NULL;
+    }
+    j->runs = 0;
+    if( f ) j->run[j->runs++].f = f;
+    return ok;
+}
+
+/* sorts lines read since last spill; writes them to new run, or to output if +last+ and no runs */
+static int icu_ext_spill(ICUExtSort * j, int last)
+{
+    ICUSortEntry * e;
+    ICUExtHeader h;
+    FILE * f = NULL;
+    long i, k;
+    int ok = 1;
+    e = malloc((j->n + 1) * sizeof(ICUSortEntry));
+    if( !e ) {
+       j->status = U_MEMORY_ALLOCATION_ERROR;
+       return 0;
+    }
+    for( i = 0; i < j->n; i++) {
+       e[i].key = j->keys.buf + j->key_off[i];
+       e[i].idx = i;
+    }
+    qsort(e, j->n, sizeof(ICUSortEntry), icu_sort_entry_cmp);
+    if( last && j->runs == 0 ) {
+       for( i = 0; ok && i < j->n; i++) {
+          k = e[i].idx;
+          ok = icu_ext_write_line(j, j->text + j->line_off[k], j->line_len[k]);
+       }
+    } else {
+       if( j->runs == EXT_MAX_RUNS ) ok = icu_ext_merge(j, 1);
+       if( ok && !(f = icu_ext_tmpfile(j)) ) ok = icu_ext_fail(j, "temporary file");
+       for( i = 0; ok && i < j->n; i++) {
+          k = e[i].idx;
+          /* keys were appended in line order */
+          h.klen = (k + 1 < j->n ? j->key_off[k + 1] : j->keys.used) - j->key_off[k];
+          h.tlen = j->line_len[k];
+          ok = icu_ext_put(j, f, e[i].key, j->text + j->line_off[k], &h);
+       }
+       if( f ) j->run[j->runs++].f = f;
+    }
+    free(e);
+    j->n = 0;
+    j->keys.used = 0;
+    return ok;
+}
+
+/* adds line text[from, to) */
+static int icu_ext_add_line(ICUExtSort * j, long from, long to)
+{
+    long * p;
+    if( j->n == j->capa ) {
+       j->capa = j->capa ? j->capa * 2 : 1024;
+       if( !(p = realloc(j->key_off, j->capa * sizeof(long))) ) goto nomem;
+       j->key_off = p;
+       if( !(p = realloc(j->line_off, j->capa * sizeof(long))) ) goto nomem;
+       j->line_off = p;
+       if( !(p = realloc(j->line_len, j->capa * sizeof(long))) ) goto nomem;
+       j->line_len = p;
+    }
+    j->key_off[j->n] = icu_col_key_append(j->col, j->text + from, to - from, &j->keys);
+    if( j->key_off[j->n] < 0 ) goto nomem;
+    j->line_off[j->n] = from;
+    j->line_len[j->n] = to - from;
+    j->n++;
+    return 1;
+nomem:
+    j->status = U_MEMORY_ALLOCATION_ERROR;
+    return 0;
+}
+
+/* decodes next piece of input, returns 0 on error */
+static int icu_ext_decode(ICUExtSort * j, const char * src, const char * src_end, int flush)
+{
+    UChar * target, * t;
+    long need = j->text_len + (src_end - src) + 16;
+    do {
+       if( need > j->text_capa ) {
+          j->text_capa = need * 2;
+          if( !(t = realloc(j->text, j->text_capa * sizeof(UChar))) ) {
+             j->status = U_MEMORY_ALLOCATION_ERROR;
+             return 0;
+          }
+          j->text = t;
+       }
+       j->status = U_ZERO_ERROR;
+       target = j->text + j->text_len;
+       ucnv_toUnicode(j->cnv, &target, j->text + j->text_capa, &src, src_end, NULL, flush, &j->status);
+       j->text_len = target - j->text;
+       need = j->text_capa + 1;
+    } while( j->status == U_BUFFER_OVERFLOW_ERROR );
+    return U_SUCCESS(j->status);
+}
+
+static int icu_ext_sort(ICUExtSort * j)
+{
+    char buf[EXT_READ_SIZE];
+    size_t got;
+    long start = 0, scan = 0;
+    int flush = 0;
+
+    if( !(j->in = fopen(j->in_path, "rb")) ) return icu_ext_fail(j, j->in_path);
+    while( !flush ) {
+       got = fread(buf, 1, sizeof(buf), j->in);
+       if( ferror(j->in) ) return icu_ext_fail(j, j->in_path);
+       flush = got < sizeof(buf);
+       if( !icu_ext_decode(j, buf, buf + got, flush) ) return 0;
+       for( ; scan < j->text_len; scan++) {
+          if( j->text[scan] != 0x0A ) continue;
+          if( !icu_ext_add_line(j, start, scan) ) return 0;
+          start = scan + 1;
+          /* only text of added lines counts: spill can't free the rest */
+          if( j->keys.used + start * (long) sizeof(UChar) + j->n * 4 * (long) sizeof(long) > j->limit ) {
+             if( !icu_ext_spill(j, 0) ) return 0;
+             /* keep incomplete line only */
+             MEMMOVE(j->text, j->text + start, UChar, j->text_len - start);
+             j->text_len -= start;
+             scan -= start;
+             start = 0;
+          }
+       }
+    }
+    if( start < j->text_len && !icu_ext_add_line(j, start, j->text_len) ) return 0;
+    if( !(j->out = fopen(j->out_path, "wb")) ) return icu_ext_fail(j, j->out_path);
+    if( !icu_ext_spill(j, 1) ) return 0;
+    if( j->runs > 0 && !icu_ext_merge(j, 0) ) return 0;
+    if( !icu_ext_write(j, NULL, 0) ) return 0;
+    if( fflush(j->out) ) return icu_ext_fail(j, j->out_path);
+    return 1;
+}
+
+/**
+ * call-seq:
+ *     collator.sort_file(in_path, out_path, options = {}) -> Fixnum
+ *
+ * Sorts lines of text file +in_path+ by this collator, and writes them to +out_path+, each
+ * line ending with "\n". Lines are decoded, keyed and sorted in memory until given limit, 
+ * then sorted runs of (sort key, line) are written to temporary files and finally merged,
+ * so files much larger than memory can be sorted. Sort is stable. Returns number of lines.
+ * Valid options are:
+ *
+ *      :encoding     -- encoding of both files, default 'utf8'
+ *      :memory_limit -- bytes of memory to use for lines and keys, default 64 MB
+ *      :tmpdir       -- directory for temporary files, default is system one
+ *
+ *     col.sort_file("words.txt", "sorted.txt", :memory_limit => 256 * 1024 * 1024)
+ **/
+VALUE icu4r_col_sort_file(int argc, VALUE * argv, VALUE self)
+{
+    ICUExtSort j;
+    UErrorCode status = U_ZERO_ERROR;
+    VALUE in_path, out_path, options, val;
+    const char * encoding = "utf8";
+    int i;
+
+    rb_scan_args(argc, argv, "21", &in_path, &out_path, &options);
+    Check_Type(in_path, T_STRING);
+    Check_Type(out_path, T_STRING);
+    MEMZERO(&j, ICUExtSort, 1);
+    j.in_path = RSTRING(in_path)->ptr;
+    j.out_path = RSTRING(out_path)->ptr;
+    j.limit = 64 * 1024 * 1024;
+    if( !NIL_P(options) ) {
+       Check_Type(options, T_HASH);
+       val = rb_hash_aref(options, ID2SYM(rb_intern("encoding")));
+       if( !NIL_P(val) ) {
+          Check_Type(val, T_STRING);
+          encoding = RSTRING(val)->ptr;
+       }
+       val = rb_hash_aref(options, ID2SYM(rb_intern("memory_limit")));
+       if( !NIL_P(val) ) {
+          j.limit = NUM2LONG(val);
+          if( j.limit < EXT_MIN_MEMORY ) j.limit = EXT_MIN_MEMORY;
+       }
+       val = rb_hash_aref(options, ID2SYM(rb_intern("tmpdir")));
+       if( !NIL_P(val) ) {
+          Check_Type(val, T_STRING);
+          j.tmpdir = RSTRING(val)->ptr;
+       }
+    }
+    if( strlen(encoding) >= UCNV_MAX_CONVERTER_NAME_LENGTH ) rb_raise(rb_eArgError, "Converter name is too long");
+    j.cnv = icu_cnv_checkout(encoding, &status);
+    if( U_FAILURE(status) ) rb_raise(rb_eArgError, u_errorName(status));
+    j.col = UCOLLATOR(self);
+
+    icu_ext_sort(&j);
+
+    for( i = 0; i < j.runs; i++) fclose(j.run[i].f);
+    for( i = 0; i <= EXT_MAX_RUNS; i++) free(j.run[i].buf);
+    if( j.in ) fclose(j.in);
+    if( j.out && fclose(j.out) && !j.err ) {
+       j.err = errno;
+       j.err_path = j.out_path;
+    }
+    free(j.text);
+    free(j.keys.buf);
+    free(j.key_off);
+    free(j.line_off);
+    free(j.line_len);
+    icu_cnv_checkin(encoding, j.cnv);
+    if( j.err ) {
+       errno = j.err;
+       rb_sys_fail(j.err_path);
+    }
+    if( j.status == U_MEMORY_ALLOCATION_ERROR ) rb_memerror();
+    if( U_FAILURE(j.status) ) rb_raise(rb_eArgError, u_errorName(j.status));
+    return LONG2NUM(j.lines);
+}
+
+/* --------- UCollator::Index: strings ordered by precomputed sort keys */
+typedef struct {
+    long         key;		/* offset of sort key in arena */
+    VALUE        str;
+} ICUIndexEntry;
+
+typedef struct {
+    UCollator     * col;
+    VALUE           owner;	/* collator cloned, may own tailoring image */
+    ICUKeyArena     keys;
+    ICUIndexEntry * e;
+    long            n, capa;
+} ICUIndex;
+
+#define UCOLINDEX(obj) ((ICUIndex *)DATA_PTR(obj))
+#define INDEX_KEY(x, i) ((x)->keys.buf + (x)->e[i].key)
+
+static void icu_index_mark(ICUIndex * x)
+{
+    long i;
+    rb_gc_mark(x->owner);
+    for( i = 0; i < x->n; i++) rb_gc_mark(x->e[i].str);
+}
+
+static void icu_index_free(ICUIndex * x)
+{
+    if( x->col ) ucol_close(x->col);
+    free(x->keys.buf);
+    free(x->e);
+    free(x);
+}
+
+static VALUE icu_index_alloc(VALUE klass)
+{
+    ICUIndex * x = ALLOC(ICUIndex);
+    MEMZERO(x, ICUIndex, 1);
+    x->owner = Qnil;
+    return Data_Wrap_Struct(klass, icu_index_mark, icu_index_free, x);
+}
+
+static ICUIndex * icu_index_get(VALUE self)
+{
+    ICUIndex * x = UCOLINDEX(self);
+    if( !x->col ) rb_raise(rb_eRuntimeError, "Index is not initialized");
+    return x;
+}
+
+/* appends sort key of UString or UTF-8 String +str+ to index arena, returns its offset */
+static long icu_index_key(ICUIndex * x, VALUE str)
+{
+    long off;
+    str = icu_col_ustr(str);
+    off = icu_col_key_append(x->col, ICU_PTR(str), ICU_LEN(str), &x->keys);
+    if( off < 0 ) rb_memerror();
+    return off;
+}
+
+/* first position, which key is greater than (+upper+) or not less than +key+ */
+static long icu_index_bound(ICUIndex * x, const char * key, int upper)
+{
+    long lo = 0, hi = x->n, mid;
+    int r;
+    while( lo < hi ) {
+       mid = lo + (hi - lo) / 2;
+       r = strcmp(INDEX_KEY(x, mid), key);
+       if( r < 0 || (upper && r == 0) ) lo = mid + 1;
+       else hi = mid;
+    }
+    return lo;
+}
+
+/* computes bound of +len+ bytes key at +off+ for prefix search into arena, returns its offset.
+ * On error arena is truncated to +off+. */
+static long icu_index_prefix_bound(ICUIndex * x, long off, int32_t len, UColBoundMode mode)
+{
+    ICUKeyArena * a = &x->keys;
+    UErrorCode status = U_ZERO_ERROR;
+    int32_t need;
+    char * buf;
+    need = ucol_getBound((uint8_t *) a->buf + off, len, mode, 1, NULL, 0, &status);
+    /* bound may be longer than key */
+    if( a->used + need > a->size ) {
+       buf = realloc(a->buf, a->used + need);
+       if( !buf ) {
+           a->used = off;
+           rb_memerror();
+       }
+       a->buf = buf;
+       a->size = a->used + need;
+    }
+    status = U_ZERO_ERROR;
+    ucol_getBound((uint8_t *) a->buf + off, len, mode, 1, (uint8_t *) a->buf + a->used, need, &status);
+    if( U_FAILURE(status) ) {
+        a->used = off;
+        ICU_RAISE(status);
+    }
+    a->used += need;
+    return a->used - need;
+}
+
+/**
+ * call-seq:
+ *     UCollator::Index.new(collator, array = []) 
+ *
+ * Creates index of UStrings (or UTF-8 Strings) from +array+, ordered by +collator+.
+ * Sort keys are computed once, with a copy of collator, so later changes of collator 
+ * don't affect the index. Lookups compare sort keys with memcmp, collator is used only 
+ * to compute key of a string being looked up.
+ *
+ *     idx = UCollator::Index.new(UCollator.new("en"), names)
+ *     idx.prefix("jo")   # => ["joan", "John", "Jones"]
+ **/
+VALUE icu_index_init(int argc, VALUE * argv, VALUE self)
+{
+    ICUIndex * x = UCOLINDEX(self);
+    UErrorCode status = U_ZERO_ERROR;
+    ICUSortEntry * s;
+    VALUE col, ary, keys;
+    int32_t size = U_COL_SAFECLONE_BUFFERSIZE;
+    long i, n, * off;
+
+    rb_scan_args(argc, argv, "11", &col, &ary);
+    Check_Class(col, rb_cUCollator);
+    if( NIL_P(ary) ) ary = rb_ary_new();
+    Check_Type(ary, T_ARRAY);
+    n = RARRAY(ary)->len;
+    keys = rb_ary_new2(n);
+    for( i = 0; i < n; i++) rb_ary_push(keys, icu_col_ustr(RARRAY(ary)->ptr[i]));
+
+    if( x->col ) ucol_close(x->col);
+    free(x->keys.buf);
+    free(x->e);
+    MEMZERO(x, ICUIndex, 1);
+    x->owner = col;
+    x->col = ucol_safeClone(UCOLLATOR(col), NULL, &size, &status);
+    ICU_RAISE(status);
+
+    off = ALLOC_N(long, n + 1);
+    icu_col_keys(x->col, keys, &x->keys, off);
+    s = ALLOC_N(ICUSortEntry, n + 1);
+    for( i = 0; i < n; i++) {
+       s[i].key = x->keys.buf + off[i];
+       s[i].idx = i;
+    }
+    qsort(s, n, sizeof(ICUSortEntry), icu_sort_entry_cmp);
+    x->capa = n < 16 ? 16 : n;
+    x->e = ALLOC_N(ICUIndexEntry, x->capa);
+    for( i = 0; i < n; i++) {
+       x->e[i].key = s[i].key - x->keys.buf;
+       x->e[i].str = RARRAY(ary)->ptr[s[i].idx];
+       x->n++;
+    }
+    free(s);
+    free(off);
+    return self;
+}
+
+/**
+ * call-seq:
+ *     index.insert(str) -> index
+ *     index << str      -> index
+ *
+ * Adds UString (or UTF-8 String) to index, after all strings equal to it.
+ **/
+VALUE icu_index_insert(VALUE self, VALUE str)
+{
+    ICUIndex * x = icu_index_get(self);
+    long off, pos;
+    rb_check_frozen(self);
+    off = icu_index_key(x, str);
+    pos = icu_index_bound(x, x->keys.buf + off, 1);
+    if( x->n == x->capa ) {
+       x->capa *= 2;
+       REALLOC_N(x->e, ICUIndexEntry, x->capa);
+    }
+    MEMMOVE(x->e + pos + 1, x->e + pos, ICUIndexEntry, x->n - pos);
+    x->e[pos].key = off;
+    x->e[pos].str = str;
+    x->n++;
+    return self;
+}
+
+/**
+ * call-seq:
+ *     index.lower_bound(str) -> Fixnum
+ *
+ * Position of first string in index, which is not less than +str+.
+ **/
+VALUE icu_index_lower_bound(VALUE self, VALUE str)
+{
+    ICUIndex * x = icu_index_get(self);
+    long off = icu_index_key(x, str), pos;
+    pos = icu_index_bound(x, x->keys.buf + off, 0);
+    x->keys.used = off;
+    return LONG2NUM(pos);
+}
+
+/**
+ * call-seq:
+ *     index.upper_bound(str) -> Fixnum
+ *
+ * Position of first string in index, which is greater than +str+.
+ **/
+VALUE icu_index_upper_bound(VALUE self, VALUE str)
+{
+    ICUIndex * x = icu_index_get(self);
+    long off = icu_index_key(x, str), pos;
+    pos = icu_index_bound(x, x->keys.buf + off, 1);
+    x->keys.used = off;
+    return LONG2NUM(pos);
+}
+
+/**
+ * call-seq:
+ *     index.bsearch(str) -> obj or nil
+ *
+ * Returns first string in index, equal to +str+ by collator, or nil.
+ **/
+VALUE icu_index_bsearch(VALUE self, VALUE str)
+{
+    ICUIndex * x = icu_index_get(self);
+    long off = icu_index_key(x, str), pos;
+    VALUE ret = Qnil;
+    pos = icu_index_bound(x, x->keys.buf + off, 0);
+    if( pos < x->n && !strcmp(INDEX_KEY(x, pos), x->keys.buf + off) ) ret = x->e[pos].str;
+    x->keys.used = off;
+    return ret;
+}
+
+/**
+ * call-seq:
+ *     index.prefix(str) -> an_array
+ *
+ * Returns strings, which start with +str+, in index order. Prefix is matched by 
+ * primary weights, so case and accent differences are ignored: "jo" matches "Jöns".
+ **/
+VALUE icu_index_prefix(VALUE self, VALUE str)
+{
+    ICUIndex * x = icu_index_get(self);
+    long off = icu_index_key(x, str), lower, upper, from, to;
+    VALUE ret;
+    if( (unsigned char) x->keys.buf[off] <= 1 ) {
+       /* no primary weights: empty or ignorable prefix matches everything */
+       from = 0;
+       to = x->n;
+    } else {
+       lower = icu_index_prefix_bound(x, off, x->keys.used - off, UCOL_BOUND_LOWER);
+       upper = icu_index_prefix_bound(x, off, lower - off, UCOL_BOUND_UPPER_LONG);
+       from = icu_index_bound(x, x->keys.buf + lower, 0);
+       to = icu_index_bound(x, x->keys.buf + upper, 0);
+    }
+    x->keys.used = off;
+    ret = rb_ary_new2(to - from);
+    for( ; from < to; from++) rb_ary_push(ret, x->e[from].str);
+    return ret;
+}
+
+/**
+ * call-seq:
+ *     index[pos] -> obj or nil
+ *
+ * Returns string at position +pos+ in index order.
+ **/
+VALUE icu_index_aref(VALUE self, VALUE pos)
+{
+    ICUIndex * x = icu_index_get(self);
+    long i = NUM2LONG(pos);
+    if( i < 0 ) i += x->n;
+    if( i < 0 || i >= x->n ) return Qnil;
+    return x->e[i].str;
+}
+
+/**
+ * call-seq:
+ *     index.size -> Fixnum
+ *
+ * Number of strings in index.
+ **/
+VALUE icu_index_size(VALUE self)
+{
+    return LONG2NUM(UCOLINDEX(self)->n);
+}
+
+/**
+ * call-seq:
+ *     index.each {|str| block } -> index
+ *
+ * Yields strings in index order.
+ **/
+VALUE icu_index_each(VALUE self)
+{
+    long i;
+#ifdef RETURN_ENUMERATOR
+    RETURN_ENUMERATOR(self, 0, 0);
+#endif
+    for( i = 0; i < UCOLINDEX(self)->n; i++) rb_yield(UCOLINDEX(self)->e[i].str);
+    return self;
+}
+
 void initialize_collator()
 {
   rb_cUCollator = rb_define_class("UCollator", rb_cObject);
   rb_define_alloc_func(rb_cUCollator, icu4r_col_alloc);
 
   rb_define_method(rb_cUCollator, "initialize", icu4r_col_init, -1);
+  rb_define_singleton_method(rb_cUCollator, "from_rules", icu4r_col_from_rules, 1);
+  rb_define_singleton_method(rb_cUCollator, "from_binary", icu4r_col_from_binary, 1);
+  rb_define_method(rb_cUCollator, "to_binary", icu4r_col_to_binary, 0);
   rb_define_method(rb_cUCollator, "strength",  icu4r_col_get_strength, 0);
   rb_define_method(rb_cUCollator, "strength=", icu4r_col_set_strength, 1);
   rb_define_method(rb_cUCollator, "get_attr",  icu4r_col_get_attr, 1);
@@ -199,7 +2007,33 @@ void initialize_collator()
   rb_define_method(rb_cUCollator, "set_attr",  icu4r_col_set_attr, 2);
   rb_define_alias(rb_cUCollator, "[]=", "set_attr");
   rb_define_method(rb_cUCollator, "strcoll", icu4r_col_strcoll, 2);
-  rb_define_method(rb_cUCollator, "sort_key",icu4r_col_sort_key, 1);
+  rb_define_method(rb_cUCollator, "sort_key",icu4r_col_sort_key, -1);
+  rb_define_method(rb_cUCollator, "sort", icu4r_col_sort, -1);
+  rb_define_method(rb_cUCollator, "sort_by", icu4r_col_sort_by, -1);
+  rb_define_method(rb_cUCollator, "sort_keys", icu4r_col_sort_keys, -1);
+  rb_define_method(rb_cUCollator, "min_by", icu4r_col_min_by, 1);
+  rb_define_method(rb_cUCollator, "max_by", icu4r_col_max_by, 1);
+  rb_define_method(rb_cUCollator, "top_k", icu4r_col_top_k, 2);
+  rb_define_method(rb_cUCollator, "hash_key", icu4r_col_hash_key, 1);
+  rb_define_method(rb_cUCollator, "uniq", icu4r_col_uniq, 1);
+  rb_define_method(rb_cUCollator, "group_by", icu4r_col_group_by, 1);
+  rb_define_method(rb_cUCollator, "merge", icu4r_col_merge, -1);
+  rb_define_method(rb_cUCollator, "sort_file", icu4r_col_sort_file, -1);
+
+  rb_cUCollatorIndex = rb_define_class_under(rb_cUCollator, "Index", rb_cObject);
+  rb_include_module(rb_cUCollatorIndex, rb_mEnumerable);
+  rb_define_alloc_func(rb_cUCollatorIndex, icu_index_alloc);
+  rb_define_method(rb_cUCollatorIndex, "initialize", icu_index_init, -1);
+  rb_define_method(rb_cUCollatorIndex, "insert", icu_index_insert, 1);
+  rb_define_alias(rb_cUCollatorIndex, "<<", "insert");
+  rb_define_method(rb_cUCollatorIndex, "lower_bound", icu_index_lower_bound, 1);
+  rb_define_method(rb_cUCollatorIndex, "upper_bound", icu_index_upper_bound, 1);
+  rb_define_method(rb_cUCollatorIndex, "bsearch", icu_index_bsearch, 1);
+  rb_define_method(rb_cUCollatorIndex, "prefix", icu_index_prefix, 1);
+  rb_define_method(rb_cUCollatorIndex, "[]", icu_index_aref, 1);
+  rb_define_method(rb_cUCollatorIndex, "size", icu_index_size, 0);
+  rb_define_alias(rb_cUCollatorIndex, "length", "size");
+  rb_define_method(rb_cUCollatorIndex, "each", icu_index_each, 0);
   
   /* attributes */
   rb_define_const(rb_cUCollator, "UCOL_FRENCH_COLLATION", INT2FIX(UCOL_FRENCH_COLLATION));
@@ -4,16 +4,221 @@ extern VALUE icu_ustr_new_set(UChar * ptr, long len, long capa);
 extern VALUE rb_cUConverter;
 
 #define UCONVERTER(obj) ((UConverter *)DATA_PTR(obj))
- 
+
+/* --------- pool of opened converters, keyed by name */
+#define CNV_POOL_SIZE 16
+typedef struct {
+    char         name[UCNV_MAX_CONVERTER_NAME_LENGTH];
+    UConverter * cnv;
+} ICUConverterSlot;
+
+static ICUConverterSlot s_cnv_pool[CNV_POOL_SIZE];
+static int s_cnv_pool_next = 0;
+
+/**
+ * Takes converter for +name+ out of the pool, or opens a new one.
+ * Converter is reset to its default state. Must be returned with icu_cnv_checkin,
+ * and may not be shared while checked out.
+ */
+UConverter * icu_cnv_checkout(const char * name, UErrorCode * status)
+{
+    int i;
+    UConverter * cnv;
+    for( i = 0; i < CNV_POOL_SIZE; i++) {
+       if( s_cnv_pool[i].cnv && !strcmp(s_cnv_pool[i].name, name)) {
+          cnv = s_cnv_pool[i].cnv;
+          s_cnv_pool[i].cnv = NULL;
+          ucnv_reset(cnv);
+          return cnv;
+       }
+    }
+    return ucnv_open(name, status);
+}
+
+/**
+ * Returns converter, obtained by icu_cnv_checkout(name), to the pool.
+ * When pool is full, the oldest entry is closed.
+ */
+void icu_cnv_checkin(const char * name, UConverter * cnv)
+{
+    int i, slot = -1;
+    if( !cnv ) return;
+    if( strlen(name) >= UCNV_MAX_CONVERTER_NAME_LENGTH ) {
+       ucnv_close(cnv);
+       return;
+    }
+    for( i = 0; i < CNV_POOL_SIZE; i++) {
+       if( !s_cnv_pool[i].cnv ) { slot = i; break; }
+    }
+    if( slot == -1 ) {
+       slot = s_cnv_pool_next;
+       s_cnv_pool_next = (s_cnv_pool_next + 1) % CNV_POOL_SIZE;
+       ucnv_close(s_cnv_pool[slot].cnv);
+    }
+    strcpy(s_cnv_pool[slot].name, name);
+    s_cnv_pool[slot].cnv = cnv;
+}
+
+/* --------- error policies */
+static const char * s_cnv_policies[] = { "substitute", "skip", "escape", "stop" };
+
+/**
+ * Converts symbol to one of ICU_CNV_* policies.
+ */
+int icu_cnv_policy(VALUE sym)
+{
+    const char * name;
+    int i;
+    Check_Type(sym, T_SYMBOL);
+    name = rb_id2name(SYM2ID(sym));
+    for( i = 0; i < 4; i++) {
+       if( !strcmp(name, s_cnv_policies[i]) ) return i;
+    }
+    rb_raise(rb_eArgError, "Unknown error policy: %s", name);
+    return 0;
+}
+
+static void icu_cnv_to_u_errors(const void * context, UConverterToUnicodeArgs * args,
+    const char * units, int32_t length, UConverterCallbackReason reason, UErrorCode * err)
+{
+    ICUCnvErrors * e = (ICUCnvErrors *) context;
+    long off;
+    if( reason <= UCNV_IRREGULAR && e->count++ == 0 && e->src ) {
+       off = args->source - e->src - length;
+       e->offset = off < 0 ? 0 : off;
+    }
+    switch( e->policy ) {
+      case ICU_CNV_SKIP:   UCNV_TO_U_CALLBACK_SKIP(NULL, args, units, length, reason, err); break;
+      case ICU_CNV_ESCAPE: UCNV_TO_U_CALLBACK_ESCAPE(UCNV_ESCAPE_C, args, units, length, reason, err); break;
+      case ICU_CNV_STOP:   UCNV_TO_U_CALLBACK_STOP(NULL, args, units, length, reason, err); break;
+      default:             UCNV_TO_U_CALLBACK_SUBSTITUTE(NULL, args, units, length, reason, err);
+    }
+}
+
+static void icu_cnv_from_u_errors(const void * context, UConverterFromUnicodeArgs * args,
+    const UChar * units, int32_t length, UChar32 cp, UConverterCallbackReason reason, UErrorCode * err)
+{
+    ICUCnvErrors * e = (ICUCnvErrors *) context;
+    long off;
+    if( reason <= UCNV_IRREGULAR && e->count++ == 0 && e->usrc ) {
+       off = args->source - e->usrc - length;
+       e->offset = off < 0 ? 0 : off;
+    }
+    switch( e->policy ) {
+      case ICU_CNV_SKIP:   UCNV_FROM_U_CALLBACK_SKIP(NULL, args, units, length, cp, reason, err); break;
+      case ICU_CNV_ESCAPE: UCNV_FROM_U_CALLBACK_ESCAPE(UCNV_ESCAPE_JAVA, args, units, length, cp, reason, err); break;
+      case ICU_CNV_STOP:   UCNV_FROM_U_CALLBACK_STOP(NULL, args, units, length, cp, reason, err); break;
+      default:             UCNV_FROM_U_CALLBACK_SUBSTITUTE(NULL, args, units, length, cp, reason, err);
+    }
+}
+
+/**
+ * Installs callbacks, which handle and count errors according to +e+.
+ * Pooled converters must be restored with icu_cnv_clear_policy before checkin.
+ */
+void icu_cnv_set_policy(UConverter * cnv, ICUCnvErrors * e, UErrorCode * status)
+{
+    e->count = 0;
+    e->offset = -1;
+    e->src = NULL;
+    e->usrc = NULL;
+    ucnv_setToUCallBack(cnv, icu_cnv_to_u_errors, e, NULL, NULL, status);
+    ucnv_setFromUCallBack(cnv, icu_cnv_from_u_errors, e, NULL, NULL, status);
+}
+
+/**
+ * Restores default (substituting) callbacks.
+ */
+void icu_cnv_clear_policy(UConverter * cnv)
+{
+    UErrorCode status = U_ZERO_ERROR;
+    ucnv_setToUCallBack(cnv, UCNV_TO_U_CALLBACK_SUBSTITUTE, NULL, NULL, NULL, &status);
+    ucnv_setFromUCallBack(cnv, UCNV_FROM_U_CALLBACK_SUBSTITUTE, NULL, NULL, NULL, &status);
+}
+
+/* returns error context of converter, or NULL if it has default callbacks */
+static ICUCnvErrors * icu_cnv_errors(UConverter * cnv)
+{
+    UConverterToUCallback action;
+    const void * context;
+    ucnv_getToUCallBack(cnv, &action, &context);
+    return action == icu_cnv_to_u_errors ? (ICUCnvErrors *) context : NULL;
+}
+
+/**
+ * Decodes +src_len+ bytes of +src+ into new buffer of +capa+ units, returns it and
+ * sets +len+. If +e+ is given, it is reset and collects errors; with :stop policy the
+ * text before the first error is returned. Caller must check +status+ and free the buffer.
+ */
+UChar * icu_cnv_to_uchars(UConverter * cnv, ICUCnvErrors * e, const char * src, long src_len,
+    long * len, long * capa, UErrorCode * status)
+{
+    UChar * buf;
+    *capa = src_len + 1;
+    buf = ALLOC_N(UChar, *capa);
+    for(;;) {
+       *status = U_ZERO_ERROR;
+       if( e ) { e->count = 0; e->offset = -1; e->src = src; e->usrc = NULL; }
+       *len = ucnv_toUChars(cnv, buf, *capa - 1, src, src_len, status);
+       if( *len < *capa ) break;
+       *capa = *len + 1;
+       REALLOC_N(buf, UChar, *capa);
+    }
+    if( e && e->policy == ICU_CNV_STOP && e->count ) *status = U_ZERO_ERROR;
+    if( *status == U_STRING_NOT_TERMINATED_WARNING ) *status = U_ZERO_ERROR;
+    return buf;
+}
+
+/**
+ * Encodes +src_len+ units of +src+ into new buffer, see icu_cnv_to_uchars.
+ */
+char * icu_cnv_from_uchars(UConverter * cnv, ICUCnvErrors * e, const UChar * src, long src_len,
+    long * len, UErrorCode * status)
+{
+    char * buf;
+    long capa = src_len + 1;
+    buf = ALLOC_N(char, capa);
+    for(;;) {
+       *status = U_ZERO_ERROR;
+       if( e ) { e->count = 0; e->offset = -1; e->src = NULL; e->usrc = src; }
+       *len = ucnv_fromUChars(cnv, buf, capa - 1, src, src_len, status);
+       if( *len < capa ) break;
+       capa = *len + 1;
+       REALLOC_N(buf, char, capa);
+    }
+    if( e && e->policy == ICU_CNV_STOP && e->count ) *status = U_ZERO_ERROR;
+    if( *status == U_STRING_NOT_TERMINATED_WARNING ) *status = U_ZERO_ERROR;
+    return buf;
+}
+
 static void icu4r_cnv_free(UConverter * conv)
 {
+    ICUCnvErrors * e;
+    if( !conv ) return;
+    e = icu_cnv_errors(conv);
     ucnv_close(conv);
+    if( e ) free(e);
 }
 static VALUE icu4r_cnv_alloc(VALUE klass)
 {
     return Data_Wrap_Struct(klass, 0, icu4r_cnv_free, 0);
 }
 
+static UConverter * icu4r_cnv_get(VALUE self)
+{
+    UConverter * cnv = UCONVERTER(self);
+    if( !cnv ) rb_raise(rb_eRuntimeError, "Converter is not initialized");
+    return cnv;
+}
+
+/* error context of initialized converter */
+static ICUCnvErrors * icu4r_cnv_get_errors(VALUE self)
+{
+    ICUCnvErrors * e = icu_cnv_errors(icu4r_cnv_get(self));
+    if( !e ) rb_raise(rb_eRuntimeError, "Converter is not initialized");
+    return e;
+}
+
 
 /**
  * call-seq:
@@ -30,13 +235,23 @@ static VALUE icu4r_cnv_alloc(VALUE klass)
  */
 VALUE icu4r_cnv_init(VALUE self, VALUE name)
 {
-    UConverter * converter;
+    UConverter * converter, * old;
+    ICUCnvErrors * e;
     UErrorCode status = U_ZERO_ERROR;
     
     Check_Type(name, T_STRING);
+    e = ALLOC(ICUCnvErrors);
+    e->policy = ICU_CNV_SUBSTITUTE;
     converter = ucnv_open(RSTRING(name)->ptr,  &status);
-    ICU_RAISE(status);
+    if( U_SUCCESS(status) ) icu_cnv_set_policy(converter, e, &status);
+    if( U_FAILURE(status) ) {
+       if( converter ) ucnv_close(converter);
+       free(e);
+       ICU_RAISE(status);
+    }
+    old = UCONVERTER(self);
     DATA_PTR(self) = converter;
+    icu4r_cnv_free(old);
     return self;
 } 
 /**
@@ -69,7 +284,7 @@ VALUE icu4r_cnv_get_subst_chars(VALUE self)
     char buf[16];
     int8_t len = 16;
     UErrorCode status = U_ZERO_ERROR;
-    ucnv_getSubstChars(UCONVERTER(self), buf, &len, &status);
+    ucnv_getSubstChars(icu4r_cnv_get(self), buf, &len, &status);
     ICU_RAISE(status);
     return rb_str_new(buf, len);
 }
@@ -85,7 +300,7 @@ VALUE icu4r_cnv_set_subst_chars(VALUE self, VALUE str)
 {
     UErrorCode status = U_ZERO_ERROR;
     Check_Type(str, T_STRING);
-    ucnv_setSubstChars(UCONVERTER(self), RSTRING(str)->ptr, RSTRING(str)->len, &status);
+    ucnv_setSubstChars(icu4r_cnv_get(self), RSTRING(str)->ptr, RSTRING(str)->len, &status);
     ICU_RAISE(status);
     return Qnil;
 }
@@ -98,7 +313,7 @@ VALUE icu4r_cnv_set_subst_chars(VALUE self, VALUE str)
  */
 VALUE icu4r_cnv_name(VALUE self)
 {
-    UConverter * cnv = UCONVERTER(self);
+    UConverter * cnv = icu4r_cnv_get(self);
     UErrorCode status = U_ZERO_ERROR;
     return rb_str_new2(ucnv_getName(cnv, &status));
 }
@@ -113,7 +328,7 @@ VALUE icu4r_cnv_name(VALUE self)
  */
 VALUE icu4r_cnv_reset(VALUE self)
 {
-    UConverter * cnv = UCONVERTER(self);
+    UConverter * cnv = icu4r_cnv_get(self);
     ucnv_reset(cnv);
     return Qnil;
 } 
@@ -123,28 +338,23 @@ VALUE icu4r_cnv_reset(VALUE self)
  *     conv.from_u(ustring) -> String 
  *
  * Convert the Unicode string into a codepage string using an existing UConverter.
+ * Unmappable characters are handled according to UConverter#on_error.
  */
 VALUE icu4r_cnv_from_unicode(VALUE self, VALUE str)
 {
-    UConverter * conv = UCONVERTER(self);
+    UConverter * conv = icu4r_cnv_get(self);
     UErrorCode status = U_ZERO_ERROR;
-    int32_t enclen, capa;
+    long len;
     char * buf;
-    VALUE s = Qnil;
+    VALUE s;
     Check_Class(str, rb_cUString);
-    capa = ICU_LEN(str) + 1;
-    buf = ALLOC_N(char, capa);
-    enclen = 	ucnv_fromUChars(conv, buf, capa-1, ICU_PTR(str), ICU_LEN(str), &status);
-    if (U_BUFFER_OVERFLOW_ERROR == status) {
-      REALLOC_N(buf, char, enclen + 1);
-      status = 0;
-      ucnv_fromUChars(conv, buf, enclen, ICU_PTR(str), ICU_LEN(str), &status);
-    }
+    buf = icu_cnv_from_uchars(conv, icu4r_cnv_get_errors(self), ICU_PTR(str), ICU_LEN(str), &len, &status);
     if( U_FAILURE(status) ){
       free(buf);
       rb_raise(rb_eArgError, u_errorName(status));
     }
-    s = rb_str_new(buf, enclen);
+    s = rb_str_new(buf, len);
+    free(buf);
     return s;
 }
 
@@ -153,30 +363,86 @@ VALUE icu4r_cnv_from_unicode(VALUE self, VALUE str)
  *     conv.to_u(string) -> UString 
  *
  * Convert the codepage string into a Unicode string using an existing UConverter.
+ * Malformed input is handled according to UConverter#on_error.
  */
 VALUE icu4r_cnv_to_unicode(VALUE self, VALUE str) 
 {
-    UConverter * conv = UCONVERTER(self);
+    UConverter * conv = icu4r_cnv_get(self);
     UErrorCode status = U_ZERO_ERROR;
     long len, capa;
-    VALUE s;
     UChar * buf;
     Check_Type(str, T_STRING);
-    capa = RSTRING(str)->len + 1;
-    buf = ALLOC_N(UChar, capa);
-    len = ucnv_toUChars(conv, buf, capa-1, RSTRING(str)->ptr, RSTRING(str)->len, &status);
-    if (U_BUFFER_OVERFLOW_ERROR == status) {
-	      capa = len+1;
-        REALLOC_N(buf, UChar, capa);
-        status = 0;
-        len = ucnv_toUChars(conv, buf, capa-1, RSTRING(str)->ptr, RSTRING(str)->len, &status);
-        if (U_FAILURE(status)) {
-          free(buf);
-          rb_raise(rb_eArgError, u_errorName(status));
-	      } 
-    }
-    s = icu_ustr_new_set(buf, len, capa);
-    return s;
+    buf = icu_cnv_to_uchars(conv, icu4r_cnv_get_errors(self), RSTRING(str)->ptr, RSTRING(str)->len, &len, &capa, &status);
+    if (U_FAILURE(status)) {
+      free(buf);
+      rb_raise(rb_eArgError, u_errorName(status));
+    } 
+    return icu_ustr_new_set(buf, len, capa);
+}
+
+/**
+ * call-seq:
+ *     conv.on_error = policy
+ *
+ * Sets handling of malformed input and unmappable characters in to_u, from_u and convert:
+ *
+ *      :substitute -- replace with substitution character (default)
+ *      :skip       -- drop them
+ *      :escape     -- replace with escape sequence: \xNN for bytes when decoding, 
+ *                     \uXXXX for characters when encoding
+ *      :stop       -- stop at the first error, returning text before it
+ *
+ * Errors never raise exception; their count and the offset of the first one are
+ * available after conversion (for the target converter of convert only the count,
+ * see UConverter#error_offset):
+ *
+ *      c = UConverter.new("US-ASCII")
+ *      c.on_error = :escape
+ *      c.from_u("café".u)          # => "caf\\u00E9"
+ *      c.error_count                # => 1
+ *      c.error_offset               # => 3
+ */
+VALUE icu4r_cnv_set_on_error(VALUE self, VALUE policy)
+{
+    icu4r_cnv_get_errors(self)->policy = icu_cnv_policy(policy);
+    return policy;
+}
+
+/**
+ * call-seq:
+ *     conv.on_error # => Symbol
+ *
+ * Returns error policy of converter, see UConverter#on_error=
+ */
+VALUE icu4r_cnv_get_on_error(VALUE self)
+{
+    return ID2SYM(rb_intern(s_cnv_policies[icu4r_cnv_get_errors(self)->policy]));
+}
+
+/**
+ * call-seq:
+ *     conv.error_count # => Fixnum
+ *
+ * Number of errors met by the last to_u, from_u or convert.
+ */
+VALUE icu4r_cnv_error_count(VALUE self)
+{
+    return LONG2NUM(icu4r_cnv_get_errors(self)->count);
+}
+
+/**
+ * call-seq:
+ *     conv.error_offset # => Fixnum or nil
+ *
+ * Offset of the first error met by the last to_u or convert (in bytes), or from_u
+ * (in code units); nil if there were no errors. Target converter of convert
+ * sees only intermediate Unicode text, so its offset is always nil, even when
+ * error_count is not zero.
+ */
+VALUE icu4r_cnv_error_offset(VALUE self)
+{
+    ICUCnvErrors * e = icu4r_cnv_get_errors(self);
+    return e->offset < 0 ? Qnil : LONG2NUM(e->offset);
 }
 
 #define BUF_SIZE 1024
@@ -184,12 +450,15 @@ VALUE icu4r_cnv_to_unicode(VALUE self, VALUE str)
  * call-seq:
  *     conv.convert(other_conv, string)
  *
- * Convert from one external charset to another using two existing UConverters,
- * ignoring the location of errors.
+ * Convert from one external charset to another using two existing UConverters.
+ * Errors are handled by on_error policies of both converters, and counted by
+ * the converter where they occurred. Only errors in source are located by
+ * error_offset of this converter; error_offset of +other_conv+ stays nil.
  */
 VALUE icu4r_cnv_convert_to(VALUE self, VALUE other, VALUE src) 
 {
    UConverter * cnv, * other_cnv;
+   ICUCnvErrors * e, * other_e;
    UErrorCode status = U_ZERO_ERROR;
    UChar pivotBuffer[BUF_SIZE];
    UChar *pivot, *pivot2;
@@ -199,13 +468,20 @@ VALUE icu4r_cnv_convert_to(VALUE self, VALUE other, VALUE src)
    Check_Class(other, rb_cUConverter);
    Check_Type(src, T_STRING);
    pivot=pivot2=pivotBuffer;
-   cnv = UCONVERTER(self);
-   other_cnv = UCONVERTER(other);
+   cnv = icu4r_cnv_get(self);
+   other_cnv = icu4r_cnv_get(other);
    src_ptr = RSTRING(src)->ptr;
    src_end = src_ptr + RSTRING(src)->len;
    ret = rb_str_new2("");
    ucnv_reset(other_cnv);
    ucnv_reset(cnv);
+   e = icu4r_cnv_get_errors(self);
+   other_e = icu4r_cnv_get_errors(other);
+   e->count = other_e->count = 0;
+   e->offset = other_e->offset = -1;
+   e->src = src_ptr;
+   other_e->src = NULL;
+   other_e->usrc = NULL;
    target_limit = buffer+BUF_SIZE;
    do {
      status = U_ZERO_ERROR;
@@ -214,6 +490,10 @@ VALUE icu4r_cnv_convert_to(VALUE self, VALUE other, VALUE src)
         &src_ptr, src_end, pivotBuffer, &pivot, &pivot2, pivotBuffer+BUF_SIZE, FALSE, TRUE, &status);
 
      if(U_FAILURE(status) && status != U_BUFFER_OVERFLOW_ERROR) {
+       if( (e->policy == ICU_CNV_STOP && e->count) || (other_e->policy == ICU_CNV_STOP && other_e->count) ) {
+         rb_str_buf_cat(ret, buffer, (int32_t)(target-buffer));
+         break;
+       }
        ICU_RAISE(status);
      }
      rb_str_buf_cat(ret, buffer, (int32_t)(target-buffer));
@@ -226,33 +506,57 @@ VALUE icu4r_cnv_convert_to(VALUE self, VALUE other, VALUE src)
  *     UConverter.convert(to_converter_name, from_converter_name, source) # => String
  *
  * Convert from one external charset to another.
- * Internally, two converters are opened according to the name arguments, then the text is converted to and from using them.
+ * Converters for both names are taken from internal pool, and the text is converted 
+ * in a single pass, growing output buffer as needed.
  */
 VALUE icu4r_cnv_convert(VALUE self, VALUE to_conv_name, VALUE from_conv_name, VALUE src)
 {
      UErrorCode status = U_ZERO_ERROR;
-     char * target = NULL;
-     int32_t target_capa, len;
+     UConverter * to_cnv, * from_cnv;
+     UChar pivotBuffer[BUF_SIZE];
+     UChar *pivot, *pivot2;
+     char * buf, * target;
+     const char * src_ptr, * src_end;
+     long capa, len;
+     UBool reset = TRUE;
      VALUE ret;
-     target_capa = ucnv_convert( RSTRING(to_conv_name)->ptr, RSTRING(from_conv_name)->ptr,
-                   target, 0,
-                   RSTRING(src)->ptr, RSTRING(src)->len, &status);
-     if(status == U_BUFFER_OVERFLOW_ERROR){
+     Check_Type(to_conv_name, T_STRING);
+     Check_Type(from_conv_name, T_STRING);
+     Check_Type(src, T_STRING);
+     to_cnv = icu_cnv_checkout(RSTRING(to_conv_name)->ptr, &status);
+     ICU_RAISE(status);
+     from_cnv = icu_cnv_checkout(RSTRING(from_conv_name)->ptr, &status);
+     if( U_FAILURE(status) ) {
+        icu_cnv_checkin(RSTRING(to_conv_name)->ptr, to_cnv);
+        ICU_RAISE(status);
+     }
+     pivot = pivot2 = pivotBuffer;
+     src_ptr = RSTRING(src)->ptr;
+     src_end = src_ptr + RSTRING(src)->len;
+     capa = RSTRING(src)->len + 16;
+     buf = ALLOC_N(char, capa);
+     target = buf;
+     do {
         status = U_ZERO_ERROR;
-        target_capa += 1;
-        target = ALLOC_N(char, target_capa);
-        len = ucnv_convert( RSTRING(to_conv_name)->ptr, RSTRING(from_conv_name)->ptr,
-                   target, target_capa,
-                   RSTRING(src)->ptr, RSTRING(src)->len, &status);
-        if(U_FAILURE(status)){           
-          free(target);
-          ICU_RAISE(status);
+        ucnv_convertEx( to_cnv, from_cnv, &target, buf + capa,
+           &src_ptr, src_end, pivotBuffer, &pivot, &pivot2, pivotBuffer+BUF_SIZE, reset, TRUE, &status);
+        reset = FALSE;
+        if( status == U_BUFFER_OVERFLOW_ERROR ) {
+           len = target - buf;
+           capa *= 2;
+           REALLOC_N(buf, char, capa);
+           target = buf + len;
         }
-        ret = rb_str_new(target, len);
-        free(target);
-        return ret;
-     } else ICU_RAISE(status);
-     return rb_str_new2("");
+     } while (status == U_BUFFER_OVERFLOW_ERROR);
+     icu_cnv_checkin(RSTRING(to_conv_name)->ptr, to_cnv);
+     icu_cnv_checkin(RSTRING(from_conv_name)->ptr, from_cnv);
+     if( U_FAILURE(status) ) {
+        free(buf);
+        ICU_RAISE(status);
+     }
+     ret = rb_str_new(buf, target - buf);
+     free(buf);
+     return ret;
 }
 /**
  * call-seq:
@@ -301,6 +605,120 @@ VALUE icu4r_cnv_all_names(VALUE self)
 	uenum_close(name_list);
 	return ret;
 }
+
+/* --------- charset detection */
+#define DETECT_SAMPLE_SIZE  65536
+#define DETECT_STRIDE_BLOCKS 16
+
+static UCharsetDetector * s_detector = NULL;
+static char * s_detect_sample = NULL;
+
+/* moves slice bounds of +text+ to UTF-8 character boundaries: +*beg+ forward past 
+ * continuation bytes, +*end+ back to lead byte of a cut sequence. Each moves by 3 bytes 
+ * at most, so sample of text in other charsets just loses a few bytes */
+static void icu_detect_align(const char * text, long len, long * beg, long * end)
+{
+    int k;
+    for( k = 0; k < 3 && *beg < *end && (text[*beg] & 0xC0) == 0x80; k++) (*beg)++;
+    for( k = 0; k < 3 && *end > *beg && *end < len && (text[*end] & 0xC0) == 0x80; k++) (*end)--;
+}
+
+/**
+ * Runs charset detection over +src+ and returns all matches, best first.
+ * Only a sample of large inputs is inspected: first +:sample+ bytes, or, when
+ * +:strided+ option is true, DETECT_STRIDE_BLOCKS blocks spread evenly over the input.
+ * Matches are owned by the shared detector and valid until next call.
+ */
+const UCharsetMatch ** icu_cnv_detect_all(VALUE src, VALUE options, int32_t * count)
+{
+    UErrorCode status = U_ZERO_ERROR;
+    const UCharsetMatch ** matches;
+    const char * text;
+    long len, sample = DETECT_SAMPLE_SIZE, block, step, i, beg, end, used;
+    VALUE opt;
+    int strided = 0;
+
+    Check_Type(src, T_STRING);
+    if( options != Qnil ) {
+       Check_Type(options, T_HASH);
+       opt = rb_hash_aref(options, ID2SYM(rb_intern("sample")));
+       if( opt != Qnil ) {
+          Check_Type(opt, T_FIXNUM);
+          sample = FIX2LONG(opt);
+          if( sample <= 0 ) rb_raise(rb_eArgError, "Sample size must be positive, got: %ld", sample);
+       }
+       strided = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("strided"))));
+    }
+    if( !s_detector ) {
+       s_detector = ucsdet_open(&status);
+       ICU_RAISE(status);
+    }
+    text = RSTRING(src)->ptr;
+    len  = RSTRING(src)->len;
+    if( len > sample ) {
+       if( strided && sample >= DETECT_STRIDE_BLOCKS ) {
+          block = sample / DETECT_STRIDE_BLOCKS;
+          step  = len / DETECT_STRIDE_BLOCKS;
+          REALLOC_N(s_detect_sample, char, block * DETECT_STRIDE_BLOCKS);
+          used = 0;
+          for( i = 0; i < DETECT_STRIDE_BLOCKS; i++) {
+             beg = i * step;
+             end = beg + block;
+             icu_detect_align(text, len, &beg, &end);
+             memcpy(s_detect_sample + used, text + beg, end - beg);
+             used += end - beg;
+          }
+          text = s_detect_sample;
+          len  = used;
+       } else {
+          beg = 0;
+          end = sample;
+          icu_detect_align(text, len, &beg, &end);
+          len = end;
+       }
+    }
+    ucsdet_setText(s_detector, text, len, &status);
+    ICU_RAISE(status);
+    matches = ucsdet_detectAll(s_detector, count, &status);
+    ICU_RAISE(status);
+    return matches;
+}
+
+/**
+ * call-seq:
+ *     UConverter.detect(bytes, options = {}) # => Array
+ *
+ * Guesses charset of the given String. Returns array of candidates 
+ * <code>[name, confidence, language]</code>, best first; confidence is 0..100.
+ * 
+ * Valid options are:
+ *      :sample -- Fixnum, max number of bytes to inspect, default 65536
+ *      :strided -- when true, sample is gathered in blocks spread over the whole input,
+ *                  instead of taking prefix of it
+ *
+ *      UConverter.detect("\357\360\356\342\345\360\352\340")[0]  # => ["windows-1251", 65, "ru"]
+ */
+VALUE icu4r_cnv_detect(int argc, VALUE * argv, VALUE self)
+{
+    UErrorCode status = U_ZERO_ERROR;
+    const UCharsetMatch ** matches;
+    const char * lang;
+    int32_t count, i;
+    VALUE src, options, ret;
+    if( rb_scan_args(argc, argv, "11", &src, &options) == 1) options = Qnil;
+    matches = icu_cnv_detect_all(src, options, &count);
+    ret = rb_ary_new2(count);
+    for( i = 0; i < count; i++) {
+       lang = ucsdet_getLanguage(matches[i], &status);
+       rb_ary_push(ret, rb_ary_new3(3, 
+            rb_str_new2(ucsdet_getName(matches[i], &status)),
+            INT2FIX(ucsdet_getConfidence(matches[i], &status)),
+            lang ? rb_str_new2(lang) : Qnil));
+       ICU_RAISE(status);
+    }
+    return ret;
+}
+
 void initialize_converter(void)
 {
   rb_cUConverter = rb_define_class("UConverter", rb_cObject);
@@ -314,9 +732,14 @@ void initialize_converter(void)
   rb_define_method(rb_cUConverter, "convert", icu4r_cnv_convert_to, 2);
   rb_define_method(rb_cUConverter, "subst_chars=", icu4r_cnv_set_subst_chars, 1);
   rb_define_method(rb_cUConverter, "subst_chars",  icu4r_cnv_get_subst_chars, 0);
+  rb_define_method(rb_cUConverter, "on_error=", icu4r_cnv_set_on_error, 1);
+  rb_define_method(rb_cUConverter, "on_error",  icu4r_cnv_get_on_error, 0);
+  rb_define_method(rb_cUConverter, "error_count",  icu4r_cnv_error_count, 0);
+  rb_define_method(rb_cUConverter, "error_offset", icu4r_cnv_error_offset, 0);
   rb_define_singleton_method(rb_cUConverter, "convert", icu4r_cnv_convert, 3);
   rb_define_singleton_method(rb_cUConverter, "list_available", icu4r_cnv_list, 0); 
   rb_define_singleton_method(rb_cUConverter, "std_names", icu4r_cnv_standard_names, 2);
   rb_define_singleton_method(rb_cUConverter, "all_names", icu4r_cnv_all_names, 0);
+  rb_define_singleton_method(rb_cUConverter, "detect", icu4r_cnv_detect, -1);
 }
 
@@ -5,6 +5,8 @@ extern void initialize_ucore_ext(void);
 extern void initialize_ubundle(void);
 extern void initialize_converter(void);
 extern void initialize_collator(void);
+extern void initialize_parallel(void);
+extern void initialize_ureader(void);
 void Init_icu4r (void) {
 
  initialize_ustring();
@@ -14,5 +16,7 @@ void Init_icu4r (void) {
  initialize_calendar();
  initialize_converter();
  initialize_collator();
+ initialize_parallel();
+ initialize_ureader();
 
 }
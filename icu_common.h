@@ -8,10 +8,12 @@
 #include <unicode/unorm.h>
 #include <unicode/ubrk.h>
 #include <unicode/ucnv.h>
+#include <unicode/ucsdet.h>
 #include <unicode/uset.h>
 #include <unicode/uenum.h>
 #include <unicode/utrans.h>
 #include <unicode/ucol.h>
+#include <unicode/uiter.h>
 #include <unicode/usearch.h>
 #include <unicode/ures.h>
 #include <unicode/unum.h>
@@ -33,13 +35,30 @@ typedef struct {
 #define ICU_RESIZE(str,capacity)  REALLOC_N(ICU_PTR(str), UChar, (capacity)+1);
 
 typedef struct  {
-    URegularExpression *pattern;
+    URegularExpression *pattern;	/* compiled; of URegexp never matched, only cloned */
     int options;
+    URegularExpression *idle;	/* matcher free for reuse, see icu_reg_matcher */
 } ICURegexp;
 
+/* conversion error policies, see UConverter#on_error= */
+#define ICU_CNV_SUBSTITUTE 0
+#define ICU_CNV_SKIP       1
+#define ICU_CNV_ESCAPE     2
+#define ICU_CNV_STOP       3
+typedef struct {
+    int           policy;
+    long          count;	/* errors met by last conversion */
+    long          offset;	/* offset of first error in source, -1 if none */
+    const char  * src;		/* source of current conversion */
+    const UChar * usrc;
+} ICUCnvErrors;
+
 
 #define  Check_Class(obj, klass)   if(CLASS_OF(obj) != klass)   rb_raise(rb_eTypeError, "Wrong type: expected %s,  got %s", rb_class2name(klass), rb_class2name(rb_obj_class(obj)));
 
 
+/* upper limit for worker threads, see parallel.c */
+#define ICU_MAX_THREADS 64
+
 #define ICU_RAISE(status) if(U_FAILURE(status)) rb_raise(rb_eRuntimeError, u_errorName(status));
 
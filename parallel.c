@@ -0,0 +1,301 @@
+/**
+ * parallel.c - helpers to spread work over native threads.
+ *
+ * Worker threads never call Ruby API: they read and write only buffers,
+ * allocated before threads start (possibly the buffer of a new result
+ * String), and the caller keeps those buffers alive until icu_parallel_for
+ * returns. Calling thread keeps interpreter lock meanwhile, so nothing
+ * else can change or free them.
+ */
+#include "icu_common.h"
+#include <pthread.h>
+#include <signal.h>
+extern VALUE rb_cUString;
+
+
+static int  s_threads = 0;			/* 0 - not detected yet */
+static long s_threshold = 8 * 1024 * 1024;	/* bytes */
+
+/**
+ * Number of threads for parallel operations.
+ */
+int icu_parallel_threads(void)
+{
+    long n = 1;
+    if( s_threads == 0 ) {
+#ifdef _SC_NPROCESSORS_ONLN
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	s_threads = n < 1 ? 1 : (n > ICU_MAX_THREADS ? ICU_MAX_THREADS : n);
+    }
+    return s_threads;
+}
+
+/**
+ * Runs fn on +n+ items of +item_size+ bytes, each in own thread;
+ * item 0 is processed by calling thread. Returns when all items are done.
+ * If thread can't be started, its item is processed by calling thread.
+ */
+void icu_parallel_for(void *(*fn)(void *), void * items, size_t item_size, int n)
+{
+    pthread_t  tid[ICU_MAX_THREADS];
+    int        started[ICU_MAX_THREADS];
+    sigset_t   all, old;
+    int        i;
+    if( n > ICU_MAX_THREADS ) n = ICU_MAX_THREADS;
+    /* signals are handled by interpreter thread only */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for( i = 1; i < n; i++) {
+	started[i] = pthread_create(&tid[i], NULL, fn, (char *)items + i * item_size) == 0;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    fn(items);
+    for( i = 1; i < n; i++) {
+	if( started[i] ) pthread_join(tid[i], NULL);
+	else fn((char *)items + i * item_size);
+    }
+}
+
+/* --------- UTF-8 <-> UTF-16 in parallel */
+typedef struct {
+    const void  * src;
+    long          src_len;	/* bytes for UTF-8, units for UTF-16 */
+    void        * dest;
+    long          dest_len;
+    UErrorCode    status;
+} ICUSlice;
+
+typedef struct {
+    int           n;
+    ICUSlice      s[ICU_MAX_THREADS];
+    void        * dest;
+    long          total;
+    int           ok;
+} ICUSliceJob;
+
+/* counts UTF-16 units needed for a valid UTF-8 slice */
+static void * utf8_count(void * p)
+{
+    ICUSlice * s = (ICUSlice *) p;
+    const unsigned char * c = (const unsigned char *) s->src, * end = c + s->src_len;
+    long n = 0;
+    for( ; c < end; c++) {
+	if( (*c & 0xC0) != 0x80 ) n += *c >= 0xF0 ? 2 : 1;
+    }
+    s->dest_len = n;
+    return NULL;
+}
+
+static void * utf8_decode(void * p)
+{
+    ICUSlice * s = (ICUSlice *) p;
+    int32_t len = 0;
+    s->status = U_ZERO_ERROR;
+    u_strFromUTF8((UChar *) s->dest, s->dest_len, &len, (const char *) s->src, s->src_len, &s->status);
+    if( s->status == U_STRING_NOT_TERMINATED_WARNING ) s->status = U_ZERO_ERROR;
+    if( U_SUCCESS(s->status) && len != s->dest_len ) s->status = U_INVALID_CHAR_FOUND;
+    return NULL;
+}
+
+/* counts UTF-8 bytes needed for a valid UTF-16 slice */
+static void * utf16_count(void * p)
+{
+    ICUSlice * s = (ICUSlice *) p;
+    const UChar * c = (const UChar *) s->src, * end = c + s->src_len;
+    long n = 0;
+    for( ; c < end; c++) {
+	if( *c < 0x80 ) n += 1;
+	else if( *c < 0x800 ) n += 2;
+	else if( U16_IS_LEAD(*c) && c + 1 < end && U16_IS_TRAIL(c[1]) ) { n += 4; c++; }
+	else n += 3;
+    }
+    s->dest_len = n;
+    return NULL;
+}
+
+static void * utf16_encode(void * p)
+{
+    ICUSlice * s = (ICUSlice *) p;
+    int32_t len = 0;
+    s->status = U_ZERO_ERROR;
+    u_strToUTF8((char *) s->dest, s->dest_len, &len, (const UChar *) s->src, s->src_len, &s->status);
+    if( s->status == U_STRING_NOT_TERMINATED_WARNING ) s->status = U_ZERO_ERROR;
+    if( U_SUCCESS(s->status) && len != s->dest_len ) s->status = U_INVALID_CHAR_FOUND;
+    return NULL;
+}
+
+/* sets destination of each slice by prefix sum of slice lengths */
+static void slices_place(ICUSliceJob * j, size_t unit_size)
+{
+    long off = 0;
+    int k;
+    for( k = 0; k < j->n; k++) {
+	j->s[k].dest = (char *) j->dest + off * unit_size;
+	off += j->s[k].dest_len;
+    }
+}
+
+static int slices_ok(ICUSliceJob * j)
+{
+    int k;
+    for( k = 0; k < j->n; k++) {
+	if( U_FAILURE(j->s[k].status) ) return 0;
+    }
+    return 1;
+}
+
+static VALUE utf8_decode_job(ICUSliceJob * j)
+{
+    int k;
+    icu_parallel_for(utf8_count, j->s, sizeof(ICUSlice), j->n);
+    j->total = 0;
+    for( k = 0; k < j->n; k++) j->total += j->s[k].dest_len;
+    j->dest = ALLOC_N(UChar, j->total + 1);
+    slices_place(j, sizeof(UChar));
+    icu_parallel_for(utf8_decode, j->s, sizeof(ICUSlice), j->n);
+    j->ok = slices_ok(j);
+    return Qnil;
+}
+
+static VALUE utf16_count_job(ICUSliceJob * j)
+{
+    int k;
+    icu_parallel_for(utf16_count, j->s, sizeof(ICUSlice), j->n);
+    j->total = 0;
+    for( k = 0; k < j->n; k++) j->total += j->s[k].dest_len;
+    return Qnil;
+}
+
+static VALUE utf16_encode_job(ICUSliceJob * j)
+{
+    slices_place(j, 1);
+    icu_parallel_for(utf16_encode, j->s, sizeof(ICUSlice), j->n);
+    j->ok = slices_ok(j);
+    return Qnil;
+}
+
+/**
+ * Whether input of +bytes+ size is worth converting in parallel.
+ */
+int icu_parallel_p(long bytes)
+{
+    return s_threshold > 0 && bytes >= s_threshold && icu_parallel_threads() > 1;
+}
+
+/**
+ * Decodes UTF-8 in parallel: input is split at lead bytes, slices are
+ * decoded directly into their places of the single output buffer.
+ * Returns malloc'ed buffer with +len+ + 1 units, or NULL if input is invalid -
+ * caller should do sequential conversion then, to report error.
+ */
+UChar * icu_utf8_decode_parallel(const char * src, long src_len, long * len)
+{
+    ICUSliceJob j;
+    long start = 0, pos;
+    int k, i;
+    j.n = icu_parallel_threads();
+    for( k = 0; k < j.n; k++) {
+	pos = k == j.n - 1 ? src_len : src_len / j.n * (k + 1);
+	for( i = 0; i < 3 && pos < src_len && ((unsigned char) src[pos] & 0xC0) == 0x80; i++) pos++;
+	if( pos < start ) pos = start;
+	j.s[k].src = src + start;
+	j.s[k].src_len = pos - start;
+	start = pos;
+    }
+    utf8_decode_job(&j);
+    if( !j.ok ) {
+	free(j.dest);
+	return NULL;
+    }
+    ((UChar *) j.dest)[j.total] = 0;
+    *len = j.total;
+    return (UChar *) j.dest;
+}
+
+/**
+ * Encodes UTF-16 to UTF-8 String in parallel: input is split between surrogate
+ * pairs, exact length of each slice is counted, and slices are encoded directly
+ * into result String. Returns Qnil if input is invalid.
+ */
+VALUE icu_utf8_encode_parallel(const UChar * src, long src_len)
+{
+    ICUSliceJob j;
+    VALUE ret;
+    long start = 0, pos;
+    int k;
+    j.n = icu_parallel_threads();
+    for( k = 0; k < j.n; k++) {
+	pos = k == j.n - 1 ? src_len : src_len / j.n * (k + 1);
+	if( pos > 0 && pos < src_len && U16_IS_TRAIL(src[pos]) && U16_IS_LEAD(src[pos-1]) ) pos++;
+	if( pos < start ) pos = start;
+	j.s[k].src = src + start;
+	j.s[k].src_len = pos - start;
+	start = pos;
+    }
+    utf16_count_job(&j);
+    ret = rb_str_new(0, j.total);
+    j.dest = RSTRING(ret)->ptr;
+    utf16_encode_job(&j);
+    return j.ok ? ret : Qnil;
+}
+
+/**
+ * call-seq:
+ *     UString.parallel_threads => fixnum
+ *
+ * Number of threads used for parallel operations. Defaults to number of CPUs.
+ */
+VALUE icu_parallel_get_threads(VALUE self)
+{
+    return INT2FIX(icu_parallel_threads());
+}
+
+/**
+ * call-seq:
+ *     UString.parallel_threads = n
+ *
+ * Sets number of threads for parallel operations, 1 disables them.
+ */
+VALUE icu_parallel_set_threads(VALUE self, VALUE n)
+{
+    Check_Type(n, T_FIXNUM);
+    if( FIX2INT(n) < 1 || FIX2INT(n) > ICU_MAX_THREADS )
+	rb_raise(rb_eArgError, "Thread count must be in 1..%d, got %d", ICU_MAX_THREADS, FIX2INT(n));
+    s_threads = FIX2INT(n);
+    return n;
+}
+
+/**
+ * call-seq:
+ *     UString.parallel_threshold => fixnum
+ *
+ * Minimal size of input in bytes, for which String#to_u and UString#to_s
+ * convert UTF-8 using several threads. Defaults to 8 MB.
+ */
+VALUE icu_parallel_get_threshold(VALUE self)
+{
+    return LONG2NUM(s_threshold);
+}
+
+/**
+ * call-seq:
+ *     UString.parallel_threshold = bytes
+ *
+ * Sets minimal size of input for parallel conversion, 0 disables it.
+ */
+VALUE icu_parallel_set_threshold(VALUE self, VALUE n)
+{
+    Check_Type(n, T_FIXNUM);
+    if( FIX2LONG(n) < 0 ) rb_raise(rb_eArgError, "Negative threshold");
+    s_threshold = FIX2LONG(n);
+    return n;
+}
+
+void initialize_parallel(void)
+{
+    rb_define_singleton_method(rb_cUString, "parallel_threads", icu_parallel_get_threads, 0);
+    rb_define_singleton_method(rb_cUString, "parallel_threads=", icu_parallel_set_threads, 1);
+    rb_define_singleton_method(rb_cUString, "parallel_threshold", icu_parallel_get_threshold, 0);
+    rb_define_singleton_method(rb_cUString, "parallel_threshold=", icu_parallel_set_threshold, 1);
+}
@@ -30,4 +30,241 @@ class UCollatorTest < Test::Unit::TestCase
    assert_equal( ["10", "100", "20", "200", "30", "300"], ar)
   end
 
+  def test_sort
+   c = UCollator.new("root")
+   c[UCollator::UCOL_NUMERIC_COLLATION]= UCollator::UCOL_ON
+   a = %w(100 10 20 30 200 300 b B a A)
+   expected = a.map { |x| x.to_u }.sort { |x, y| c.strcoll(x, y) }
+   assert_equal(expected, c.sort(a.map { |x| x.to_u }))
+   assert_equal(expected.map { |x| x.to_s }, c.sort(a))
+   assert_equal([], c.sort([]))
+   c.strength = UCollator::UCOL_PRIMARY
+   assert_equal(%w(a A b B), c.sort(%w(a A b B)).map { |x| x.to_s })
+   assert_equal(%w(A a b B), c.sort(%w(A b a B)).map { |x| x.to_s })
+   people = [[3, "b"], [1, "a"], [2, "A"]]
+   assert_equal([[1, "a"], [2, "A"], [3, "b"]], c.sort_by(people) { |p| p[1].to_u })
+   assert_raise(TypeError) { c.sort([1]) }
+   big = (1..2000).map { |i| (i * 7919 % 2000).to_s }
+   assert_equal(big.sort_by { |x| x.to_i }, c.sort(big).map { |x| x.to_s })
+  end
+
+  def test_sort_keys
+   c = UCollator.new("root")
+   a = %w(b a 10 \320\277\321\200\320\276\320\262\320\265\321\200\320\272\320\260) << "x" * 300
+   keys = c.sort_keys(a)
+   assert_equal(a.map { |x| c.sort_key(x.to_u) }, keys)
+   assert(keys.all? { |k| k.frozen? })
+   blob, offsets = c.sort_keys(a, :packed => true)
+   assert_equal(a.size + 1, offsets.size)
+   assert_equal(blob.size, offsets.last)
+   assert_equal(keys, (0...a.size).map { |i| blob[offsets[i]...offsets[i+1]] })
+   assert_equal(["", [0]], c.sort_keys([], :packed => true))
+  end
+
+  def test_sort_threads
+   c = UCollator.new("root")
+   c.strength = UCollator::UCOL_PRIMARY
+   a = (0...10000).map { |i| ["ab", "AB", "b\303\251", "be", "a"][i % 5] + (i * 7919 % 300).to_s }
+   seq = c.sort(a)
+   [2, 3, 4, 7].each do |t|
+     assert_equal(seq, c.sort(a, :threads => t))
+   end
+   pairs = (0...5000).map { |i| [i, ["x", "X", "y"][i % 3]] }
+   sorted = c.sort_by(pairs, :threads => 3) { |p| p[1] }
+   assert_equal(pairs.sort_by { |p| [p[1].downcase, p[0]] }, sorted)
+   assert_raise(ArgumentError) { c.sort(a, :threads => 0) }
+  end
+
+  def test_index
+   c = UCollator.new("en")
+   names = %w(John joan Jones Jöns Bob alice Alice Zed)
+   idx = UCollator::Index.new(c, names)
+   assert_equal(c.sort(names), idx.to_a)
+   assert_equal(names.size, idx.size)
+   assert_equal("Bob", idx.bsearch("Bob".u))
+   assert_nil(idx.bsearch("bob"))
+   assert_nil(idx.bsearch("bobby"))
+   c.strength = UCollator::UCOL_PRIMARY
+   assert_nil(idx.bsearch("bob"))
+   assert_equal(%w(joan John Jones Jöns), idx.prefix("jo"))
+   assert_equal(%w(Jones Jöns), idx.prefix("JON"))
+   assert_equal([], idx.prefix("q"))
+   assert_equal(names.size, idx.prefix("").size)
+   assert_equal(idx.lower_bound("b"), idx.upper_bound("b"))
+   lo, hi = idx.lower_bound("alice"), idx.upper_bound("alice")
+   assert_equal(["alice"], (lo...hi).map { |i| idx[i] })
+   idx << "Joe" << "alice".u
+   assert_equal(%w(alice alice Alice), idx.to_a[0, 3].map { |x| x.to_s })
+   assert_equal(%w(joan Joe John Jones Jöns), idx.prefix("jo"))
+   assert_equal("Zed", idx[-1])
+   assert_equal(UCollator.new("en").sort(idx.to_a), idx.to_a)
+   empty = UCollator::Index.new(c)
+   assert_equal(0, empty.lower_bound("a"))
+   assert_equal([], empty.prefix("a"))
+   assert_raise(TypeError) { idx << 1 }
+  end
+
+  def test_partial_keys
+   c = UCollator.new("en")
+   words = %w(delta Alpha alpha charlie bravo echo Bravo) + ["x" * 100 + "b", "x" * 100 + "a"]
+   sorted = c.sort(words)
+   [0, 1, 3, words.size, words.size + 5].each do |k|
+     assert_equal(sorted[0, k], c.top_k(words, k))
+   end
+   assert_equal(sorted.first, c.min_by(words))
+   assert_equal(sorted.last, c.max_by(words))
+   assert_nil(c.min_by([]))
+   people = [[1, "b"], [2, "a"], [3, "B"], [4, "a"]]
+   c.strength = UCollator::UCOL_PRIMARY
+   assert_equal([2, "a"], c.min_by(people) { |p| p[1] })
+   assert_equal([1, "b"], c.max_by(people) { |p| p[1] })
+   assert_equal([[2, "a"], [4, "a"], [1, "b"]], c.top_k(people, 3) { |p| p[1] })
+   big = (1..3000).map { |i| (i * 7919 % 3000).to_s }
+   assert_equal(c.sort(big)[0, 50], c.top_k(big, 50))
+   assert_raise(ArgumentError) { c.top_k(words, -1) }
+   long = %w(b a c d).map { |x| "x" * 100 + x }
+   assert_equal(long[1], c.min_by(long))
+   assert_equal(long[3], c.max_by(long))
+   assert_equal(c.sort(long)[0, 2], c.top_k(long, 2))
+   assert_equal(long[1], c.min_by(long.reverse))
+   shrink = %w(b c a)
+   assert_equal("c", c.max_by(shrink) { |x| shrink.clear; x })
+   shrink = %w(b c a)
+   assert_equal(%w(a b), c.top_k(shrink, 2) { |x| shrink.pop; x })
+   c.strength = UCollator::UCOL_TERTIARY
+   part = %w(abc abd b).map { |x| c.sort_key(x.u, 2) }
+   assert(part.all? { |k| k.size <= 2 })
+   assert_equal(part[0], part[1])
+   assert(part[1] < part[2])
+  end
+
+  def test_equivalence
+   c = UCollator.new("en")
+   names = ["Jose", "Ann", "jos\303\251", "JOSE", "ann", "Bob"]
+   assert_equal(names, c.uniq(names))
+   assert_not_equal(c.hash_key("Jose"), c.hash_key("jose".u))
+   c.strength = UCollator::UCOL_PRIMARY
+   assert_equal(c.hash_key("Jose"), c.hash_key("jos\303\251".u))
+   assert_equal(%w(Jose Ann Bob), c.uniq(names))
+   assert_equal(%w(Jose Ann Bob), c.uniq(names.map { |x| x.u }).map { |x| x.to_s })
+   groups = c.group_by(names)
+   assert_equal(3, groups.size)
+   assert_equal(["Jose", "jos\303\251", "JOSE"], groups["Jose"])
+   assert_equal(%w(Ann ann), groups["Ann"])
+   people = [[1, "b"], [2, "A"], [3, "B"], [4, "a"]]
+   assert_equal([[1, "b"], [2, "A"]], c.uniq(people) { |p| p[1] })
+   assert_equal({ "b" => [[1, "b"], [3, "B"]], "A" => [[2, "A"], [4, "a"]] }, c.group_by(people) { |p| p[1] })
+   c.strength = UCollator::UCOL_SECONDARY
+   assert_equal(["Jose", "Ann", "jos\303\251", "Bob"], c.uniq(names))
+   big = (0...5000).map { |i| (i % 1000).to_s }
+   assert_equal(big[0, 1000], c.uniq(big))
+   assert_equal([], c.uniq([]))
+   assert_equal({}, c.group_by([]))
+   shrink = %w(a b a)
+   assert_equal(%w(a b), c.uniq(shrink) { |x| shrink.clear; x })
+   shrink = %w(a b a)
+   assert_equal({ "a" => %w(a a), "b" => %w(b) }, c.group_by(shrink) { |x| shrink.clear; x })
+  end
+
+  def test_strcoll_utf8
+   c = UCollator.new("en")
+   words = ["a", "B", "b", "r\303\251sum\303\251", "resume", "\321\217", ""]
+   words.each do |x|
+     words.each do |y|
+       expected = c.strcoll(x.u, y.u)
+       assert_equal(expected, c.strcoll(x, y))
+       assert_equal(expected, c.strcoll(x.u, y))
+       assert_equal(expected, c.strcoll(x, y.u))
+     end
+   end
+   long = "ab" * 100000
+   assert_equal(-1, c.strcoll(long + "a", (long + "b").u))
+   assert_equal(1, c.strcoll("b" + long, ("a" + long).u))
+   assert_raise(TypeError) { c.strcoll("a", 1) }
+   assert_equal(c.top_k(words.map { |x| x.u }, 3).map { |x| x.to_s }, c.top_k(words, 3))
+  end
+
+  def test_rules_binary
+   c = UCollator.from_rules("&a < c < b")
+   assert_equal(%w(a c b d), c.sort(%w(d b c a)))
+   assert_raise(ArgumentError) { UCollator.from_rules("&a < < b") }
+   c.strength = UCollator::UCOL_PRIMARY
+   bin = c.to_binary
+   assert_kind_of(String, bin)
+   d = UCollator.from_binary(bin)
+   bin.replace("")
+   GC.start
+   assert_equal(%w(a c b d), d.sort(%w(d b c a)))
+   assert_equal(0, d.strcoll("A", "a"))
+   assert_equal(c.strength, d.strength)
+   sv = UCollator.new("sv")
+   e = UCollator.from_binary(sv.to_binary)
+   words = ["z", "\303\266", "a", "\303\245", "o"]
+   assert_equal(sv.sort(words), e.sort(words))
+   assert_raise(ArgumentError) { UCollator.from_binary("junk") }
+  end
+
+  def test_merge
+   require 'stringio'
+   c = UCollator.new("en")
+   a = c.sort(%w(pear apple Fig banana))
+   b = c.sort(%w(cherry Apple date))
+   d = %w(apple zucchini)
+   out = []
+   assert_same(c, c.merge(a, b.map { |x| x.u }, d) { |x| out << x.to_s })
+   assert_equal(c.sort(a + b + d), out)
+   assert_equal(%w(apple apple Apple), out[0, 3])
+   io = StringIO.new(c.sort(%w(kiwi Banana lime)).join("\n") + "\n")
+   out = []
+   c.merge(a, io) { |x| out << x.chomp }
+   assert_equal(c.sort(a + %w(kiwi Banana lime)), out)
+   if [].respond_to?(:each) && [].each.respond_to?(:next)
+     out = []
+     c.merge(b.each, [], a.each) { |x| out << x }
+     assert_equal(c.sort(a + b), out)
+   end
+   out = []
+   c.merge(a, b) { |x| out << x; break if out.size == 2 }
+   assert_equal(2, out.size)
+   out = []
+   c.merge { |x| out << x }
+   c.merge([], []) { |x| out << x }
+   assert_equal([], out)
+   big = (0...3000).map { |i| "%05d" % (i * 7919 % 3000) }
+   runs = (0...4).map { |k| c.sort(big[k * 750, 750]) }
+   out = []
+   c.merge(*runs) { |x| out << x }
+   assert_equal(big.sort, out)
+   assert_raise(TypeError) { c.merge([1]) { } }
+   assert_raise(TypeError) { c.merge(a, "apple") { } }
+   assert_raise(TypeError) { c.merge("apple".u) { } }
+   out = []
+   c.merge(UReader.new(StringIO.new("apple kiwi")), ["banana"]) { |x| out << x.to_s }
+   assert_equal(["apple ", "banana", "kiwi"], out)
+  end
+
+  def test_sort_file
+   require 'tempfile'
+   c = UCollator.new("en")
+   words = (0...150000).map { |i| ["b", "B", "\303\241", "a", "r\303\251s", "res"][i % 6] + (i * 7919 % 150000).to_s }
+   src = Tempfile.new("icu4r_in")
+   src.write(words.join("\n")); src.close
+   dst = Tempfile.new("icu4r_out")
+   dst.close
+   expected = c.sort(words).map { |x| x + "\n" }.join
+   assert_equal(words.size, c.sort_file(src.path, dst.path))
+   assert_equal(expected, File.open(dst.path, "rb") { |f| f.read })
+   assert_equal(words.size, c.sort_file(src.path, dst.path, :memory_limit => 65536, :tmpdir => File.dirname(dst.path)))
+   assert_equal(expected, File.open(dst.path, "rb") { |f| f.read })
+
+   File.open(src.path, "wb") { |f| f.write("b\na\n\303\241\nA".u.to_s("UTF-16LE")) }
+   assert_equal(4, c.sort_file(src.path, dst.path, :encoding => "UTF-16LE"))
+   assert_equal("a\nA\n\303\241\nb\n".u, UString.from_file(dst.path, "UTF-16LE"))
+   File.open(src.path, "wb") { |f| }
+   assert_equal(0, c.sort_file(src.path, dst.path))
+   assert_equal("", File.open(dst.path, "rb") { |f| f.read })
+   assert_raise(Errno::ENOENT) { c.sort_file(src.path + ".none", dst.path) }
+   assert_raise(ArgumentError) { c.sort_file(src.path, dst.path, :encoding => "no-such-encoding") }
+  end
+
 end
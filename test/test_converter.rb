@@ -60,6 +60,73 @@ class UConverterTest < Test::Unit::TestCase
     assert_equal("\341\353\377!", c1.convert(c2, a_s))
   end
 
+  def test_i_convert_class_method_growing
+    a_s = "\247\322\247\335\247\361!" * 5000
+    r_s = UConverter.convert("utf8", "EUC-JP", a_s)
+    assert_equal([0x431, 0x43B, 0x44F, 0x21].to_u * 5000, r_s.to_u)
+    assert_equal(a_s, UConverter.convert("EUC-JP", "utf8", r_s))
+    assert_equal("", UConverter.convert("utf8", "EUC-JP", ""))
+    assert_raise(RuntimeError) { UConverter.convert("no-such-charset", "utf8", "abc") }
+  end
+
+  def test_j_detect
+    a_s = "\357\360\356\342\345\360\352\340 \357\356 \360\363\361\361\352\350 \344\353\377 \342\361\345\365" * 4
+    a = UConverter.detect(a_s)
+    assert_kind_of(Array, a)
+    assert_equal("windows-1251", a[0][0])
+    assert_kind_of(Fixnum, a[0][1])
+    assert_equal(a, a_s.detect_encoding)
+    assert_equal(UConverter.new("cp1251").to_u(a_s), a_s.to_u_detect)
+    # sample and its blocks start or end inside 3-byte characters
+    b_s = "xy" + "\350\252\236" * 40000
+    assert_equal(["UTF-8", 100], UConverter.detect(b_s, :sample => 100)[0][0, 2])
+    assert_equal(["UTF-8", 100], b_s.detect_encoding(:sample => 1000, :strided => true)[0][0, 2])
+    assert_equal(b_s.to_u, b_s.to_u_detect(:sample => 1000))
+    assert_raise(ArgumentError) { UConverter.detect(a_s, :sample => 0) }
+  end
+
+  def test_k_on_error
+    c = UConverter.new("US-ASCII")
+    assert_equal(:substitute, c.on_error)
+    u = "caf\303\251 caf\303\251".u
+    c.from_u(u)
+    assert_equal(2, c.error_count)
+    assert_equal(3, c.error_offset)
+    c.on_error = :escape
+    assert_equal("caf\\u00E9 caf\\u00E9", c.from_u(u))
+    c.on_error = :skip
+    assert_equal("caf caf", c.from_u(u))
+    c.on_error = :stop
+    assert_equal("caf", c.from_u(u))
+    assert_equal(3, c.error_offset)
+    c.from_u("abc".u)
+    assert_equal(0, c.error_count)
+    assert_nil(c.error_offset)
+    assert_raise(ArgumentError) { c.on_error = :ignore }
+    blank = UConverter.allocate
+    assert_raise(RuntimeError) { blank.on_error }
+    assert_raise(RuntimeError) { blank.error_count }
+    assert_raise(RuntimeError) { blank.to_u("abc") }
+    assert_raise(RuntimeError) { c.convert(blank, "abc") }
+
+    c = UConverter.new("utf8")
+    c.on_error = :escape
+    assert_equal("ab\\xFFc\\xFE", c.to_u("ab\377c\376").to_s)
+    assert_equal(2, c.error_count)
+    assert_equal(2, c.error_offset)
+    c.on_error = :stop
+    assert_equal("ab", c.to_u("ab\377c").to_s)
+    c2 = UConverter.new("US-ASCII")
+    c2.on_error = :skip
+    assert_equal("abc", c2.convert(c, "ab\377c"))
+    assert_equal(1, c2.error_count)
+    assert_equal(2, c2.error_offset)
+    c3 = UConverter.new("utf8")
+    assert_equal("caf", c3.convert(c2, "caf\303\251"))
+    assert_equal(1, c2.error_count)
+    assert_nil(c2.error_offset)
+  end
+
   def test_h_subst_chars
     c1 = UConverter.new("US-ASCII")
     assert_kind_of(String, c1.subst_chars)
@@ -235,6 +235,16 @@ class UnicodeStringTest < Test::Unit::TestCase
       assert_equal(b, a.to_u)
   end
 
+  def test_codepoints_packed
+      a=[0x01234, 0x0434, 0x1D7D9, 0x74, 0x10FFFD]
+      b=a.to_u
+      assert_equal(7, b.length)
+      assert_equal(a.pack("L*"), b.codepoints_packed)
+      assert_equal("", "".u.codepoints_packed)
+      assert_equal([0x61, 0xFFFD, 0xFFFD].to_u, [0x61, 0xD800, 0x110000].to_u)
+      assert_raise(TypeError) { [0x61, "b"].to_u }
+  end
+
     def test_chars
     chr =      ["I", "Ñ", "T", "Ë", "R", "N", "Â", "T", "I", "Ô", "N", "À", "L", "I", "Z", "Æ", "T", "I", "Ø", "N" ]
     chr = chr.collect {|s| s.to_u.norm_C}
@@ -293,6 +303,15 @@ class UnicodeStringTest < Test::Unit::TestCase
     assert_equal(0,  UString::strcoll("ой её".u, "ОЙ ЕЁ".u, "ru", 1))
     end
 
+    def test_strcoll_cached
+    3.times do
+      assert_equal(0,  UString::strcoll("a".u, "A".u, "en", 0))
+      assert_equal(-1, UString::strcoll("a".u, "A".u, "en"))
+      assert_equal([0..2], "Fox".u.search("fox".u, :locale => "en", :ignore_case => true))
+      assert_equal([], "Fox".u.search("fox".u, :locale => "en"))
+    end
+    end
+
     def test_gsub_block
     	a = "АБРАКАДАБРА".u
 	r = URegexp.new("(.)(.)(А)".u, URegexp::IGNORECASE)
@@ -310,6 +329,36 @@ class UnicodeStringTest < Test::Unit::TestCase
 	assert_equal(0..3, m.range(0))
     end
 
+    def test_match_lazy
+	t = "ab".u
+	m = ure("(a)(x)?(b)").match(t)
+	t[0, 2] = "zz".u
+	assert_equal(3, m.size)
+	assert_equal(["ab".u, "a".u, "".u, "b".u], m.to_a)
+	assert_same(m[1], m[1])
+	assert(m[1].frozen?)
+	assert_equal("b".u, m[-1])
+	assert_nil(m[4])
+	assert_nil(m.range(2))
+	assert_equal(1..1, m.range(3))
+	assert_equal('#<UMatch [\\u0061\\u0062, \\u0061, , \\u0062]>', m.inspect)
+	d = m.dup
+	assert_equal(3, d.size)
+	assert_equal(m.to_a, d.to_a)
+	assert_equal(1..1, d.range(3))
+	assert_equal(m.to_a, m.clone.to_a)
+	kept = []
+	s = "a1b2".u
+	assert_equal("1a2b".u, s.gsub!(ure("(.)(.)")) { |x| kept << x; x[2] + x[1] })
+	assert_equal(["a1".u, "b2".u], kept.map { |x| x[0] })
+	t = "xxabcyy".u
+	m = ure("(?<=(a))b(?=(c))").match(t)
+	t.replace("zzzzzzz".u)
+	assert_equal(["b".u, "a".u, "c".u], m.to_a)
+	assert_equal(["b".u, "a".u, "c".u], m.dup.to_a)
+	assert_equal(3..3, m.range(0))
+    end
+
     def test_resbundle
     	b = UResourceBundle.open(nil, "en")
 	assert_equal("Russia".u, b["Countries"]["RU"])
@@ -505,4 +554,186 @@ class UnicodeStringTest < Test::Unit::TestCase
     s[0..s.size] = S("another string")
     assert_equal(S("another string"), s)
   end
+
+  def test_decode_encode_many
+    a = ["abc", "", "\320\263\320\264\320\265"]
+    u = UString.decode_many(a)
+    assert_equal(["abc".u, "".u, "где".u], u)
+    assert_equal(u, a.to_u_all)
+    assert_equal(a, UString.encode_many(u))
+    c = ["\355\350", "\367\345"]
+    assert_equal(["ни".u, "че".u], c.to_u_all("cp1251"))
+    assert_equal(c, UString.encode_many(c.to_u_all("cp1251"), "cp1251"))
+    assert_equal([], UString.decode_many([]))
+    assert_raise(ArgumentError) { UString.decode_many(["ok", "\377\377"]) }
+    assert_raise(TypeError) { UString.decode_many(["ok", 1]) }
+    assert_raise(TypeError) { UString.encode_many(["ok"]) }
+  end
+
+  def test_from_file
+    require 'tempfile'
+    text = "\320\263\320\264\320\265 abc\n" * 100000
+    f = Tempfile.new("icu4r")
+    f.write(text); f.close
+    assert_equal(text.u, UString.from_file(f.path))
+    assert_equal(text.u, UString.from_file(f.path, "utf8"))
+    File.open(f.path, "wb") { |o| o.write(text.u.to_s("cp1251")) }
+    assert_equal(text.u, UString.from_file(f.path, "cp1251"))
+    File.open(f.path, "wb") { |o| o.write(text.u.to_s("UTF-16LE")) }
+    assert_equal(text.u, UString.from_file(f.path, "UTF-16LE"))
+    File.open(f.path, "wb") { |o| o.write(text.u.to_s("UTF-16BE")) }
+    assert_equal(text.u, UString.from_file(f.path, "UTF-16BE"))
+    File.open(f.path, "wb") { |o| o.write("ab\377c") }
+    assert_raise(ArgumentError) { UString.from_file(f.path) }
+    assert_equal("ab\357\277\275c".u, UString.from_file(f.path, "utf8"))
+    File.open(f.path, "wb") { |o| }
+    assert_equal("".u, UString.from_file(f.path))
+    path = f.path
+    f.unlink
+    assert_raise(Errno::ENOENT) { UString.from_file(path) }
+  end
+
+  def test_write_to
+    require 'stringio'
+    a = "\320\263\320\264\320\265 abc " * 20000
+    io = StringIO.new("")
+    assert_equal(a.size, a.u.write_to(io))
+    assert_equal(a, io.string)
+    io = StringIO.new("")
+    a.u.write_to(io, "cp1251")
+    assert_equal(a.u.to_s("cp1251"), io.string)
+    chunks = []
+    "abcdefghij".u.each_encoded_chunk("utf8", 4) { |c| chunks << c }
+    assert_equal(["abcd", "efgh", "ij"], chunks)
+    b = "abc".u
+    assert_raise(RuntimeError) { b.each_encoded_chunk { |c| b << "d".u } }
+    assert_equal("abc".u, b)
+    assert_raise(ArgumentError) { b.each_encoded_chunk("utf8", 0) { } }
+  end
+
+  def test_parallel_conversion
+    threads, threshold = UString.parallel_threads, UString.parallel_threshold
+    UString.parallel_threads = 4
+    UString.parallel_threshold = 16
+    a = "\320\263\320\264 ab \360\235\204\236c" * 1001
+    UString.parallel_threshold = 0
+    u = a.to_u
+    UString.parallel_threshold = 16
+    assert_equal(u, a.to_u)
+    assert_equal(a, u.to_s)
+    assert_equal("\360\235\204\236", "\360\235\204\236".to_u.to_s)
+    assert_raise(ArgumentError) { ("ab" * 20 + "\377").to_u }
+    assert_raise(ArgumentError) { UString.parallel_threads = 0 }
+  ensure
+    UString.parallel_threads, UString.parallel_threshold = threads, threshold
+  end
+
+  def test_conversion_error_policy
+    assert_raise(ArgumentError) { "ab\377c".to_u }
+    assert_equal("ab\357\277\275c", "ab\377c".to_u(:on_error => :substitute).to_s)
+    assert_equal("abc".u, "ab\377c".to_u("utf8", :on_error => :skip))
+    assert_equal("ab".u, "ab\377c".to_u(:on_error => :stop))
+    assert_equal("\\xFF".u, "\377".to_u(:on_error => :escape))
+    u = "caf\303\251".u
+    assert_equal("caf\\u00E9", u.to_s("US-ASCII", :on_error => :escape))
+    assert_equal("caf", u.to_s("US-ASCII", :on_error => :skip))
+    assert_equal("caf\351", u.to_s("ISO-8859-1", :on_error => :stop))
+    assert_equal("caf\303\251", u.to_s(:on_error => :stop))
+    # pooled converter gets default callbacks back
+    assert_equal("caf\032", u.to_s("US-ASCII"))
+    assert_raise(ArgumentError) { u.to_s("US-ASCII", :on_error => :bogus) }
+  end
+
+  def test_reader
+    require 'stringio'
+    text = "\320\277\321\200\320\276\320\262\320\265\321\200\320\272\320\260 line one. Second e\314\201 sentence!\n" * 50
+    expected = []
+    text.u.each_line_break { |s| expected << s }
+    r = UReader.new(StringIO.new(text), :buffer_size => 7)
+    assert_equal(expected, r.to_a)
+    assert_nil(r.next)
+    assert_equal(text.u.size, r.pos)
+    sentences = []
+    text.u.each_sentence { |s| sentences << s.norm_C }
+    r = UReader.new(StringIO.new(text), :break => :sentence, :normalize => :nfc, :buffer_size => 5)
+    assert_equal(sentences[0], r.next)
+    assert_equal(sentences[1..-1], r.map { |s| s })
+    r = UReader.new(StringIO.new(text.u.to_s("cp1251", :on_error => :skip)), :encoding => "cp1251", :break => :word)
+    assert_equal("\320\277\321\200\320\276\320\262\320\265\321\200\320\272\320\260".u, r.next)
+    r.close
+    assert_raise(IOError) { r.next }
+    r = UReader.new(StringIO.new("one two"))
+    assert_equal(["one ".u, "two".u], r.to_a)
+    r.send(:initialize, StringIO.new("three four"))
+    assert_equal(["three ".u, "four".u], r.to_a)
+    assert_equal(10, r.pos)
+    assert_nil(UReader.new(StringIO.new("")).next)
+    assert_raise(ArgumentError) { UReader.new(StringIO.new(""), :break => :paragraph) }
+  end
+
+  def test_regexp_cache
+    a, b = ure('(\\w)(\\d)'), ure('(\\w)(\\d)')
+    assert_not_same(a, b)
+    s = "a1 b2 c3".u
+    assert_equal([["a".u, "1".u], ["b".u, "2".u], ["c".u, "3".u]], s.scan(a))
+    assert_equal(s.scan(a), s.scan(b))
+    40.times { |i| assert_equal("#{i}-".u, "#{i}a".u.gsub(ure("[a-z]"), "-".u)) }
+    40.times { |i| assert_equal("#{i}-".u, "#{i}a".u.gsub('[a-z]'.u, "-".u)) }
+    assert("ABC".u =~ ure("abc", URegexp::IGNORECASE))
+    assert_nil("ABC".u =~ ure("abc"))
+    assert("ABC".u =~ /abc/i.U)
+    assert_nil("ABC".u =~ /abc/.U)
+    assert("ABC".u =~ /abc/i.U)
+    assert_raise(ArgumentError) { ure("(") }
+    assert_raise(ArgumentError) { ure("(") }
+  end
+
+  def test_replacement
+    r = URegexp::Replacement.new('<$2\\$$1$>'.u)
+    assert_equal('<$2\\$$1$>'.u, r.to_u)
+    assert_equal("<b$a$> <d$c$>".u, "ab cd".u.gsub(ure('(\\w)(\\w)'), r))
+    assert_equal("<b$a$> cd".u, "ab cd".u.sub(ure('(\\w)(\\w)'), r))
+    assert_equal("<$b> <$d>".u, "ab cd".u.gsub(ure('(\\w)(\\w)'), '<$$2>'.u))
+    assert_equal("[][b]".u, "ab".u.gsub(ure('(a)|(b)'), '[$2]'.u))
+    assert_equal("[]".u, "a".u.gsub(ure('a'), '[$5]'.u))
+    assert_equal("a\\".u, "a".u.gsub(ure('a'), '$0\\\\'.u))
+    assert_raise(TypeError) { URegexp::Replacement.new("$1") }
+  end
+
+  def test_gsub_bang_in_place
+    text = "ab cd, efg hi; jk".u
+    [['(\\w)(\\w)', '$2$1'], ['(\\w)(\\w)', '$2'], ['(\\w)(\\w)', '<$2$1$2>'], ['(?<=\\w)\\w', '-'],
+     ['(?<=\\w)\\w', ''], ['\\b', '|'], ['x*', '.'], ['(\\w+)([,;])', '$2$1'], ['h', 'HHH'],
+     ['(?<=(\\w))\\w', '$1'], ['(?<=(\\w\\w))\\w', '$1']].each do |re, r|
+      expected = text.gsub(ure(re), r.u)
+      assert_equal(expected, text.clone.gsub!(ure(re), r.u), re)
+      assert_equal(text.sub(ure(re), r.u), text.clone.sub!(ure(re), r.u), re)
+    end
+    assert_equal("aab".u, "abc".u.gsub!(ure('(?<=(\\w))\\w'), '$1'.u))
+    a = ("abc " * 1000).u
+    a.gsub!(ure('(b)(c)'), '$2'.u)
+    assert_equal(("ac " * 1000).u, a)
+    a.gsub!(ure('c'), 'xyz'.u)
+    assert_equal(("axyz " * 1000).u, a)
+  end
+
+  def test_regexp_shared
+    re = ure('(\\w+)@(\\w+)')
+    # same URegexp used from within gsub block
+    s = "a@b c@d".u.gsub(re) { |m| re.match(m[0])[2] + "@".u + m[1] }
+    assert_equal("b@a d@c".u, s)
+    assert_equal(["a".u, "c".u], "a@b x c@d".u.scan(re).map { |g| g[0] })
+    threads = (0...4).map do |t|
+      Thread.new do
+        text = "#{t}@x ".u * 20
+        ok = true
+        200.times do
+          ok &&= text.gsub(re) { |m| Thread.pass; m[2] + m[1] } == "x#{t} ".u * 20
+          ok &&= text.index(re, 3) == 4 && re.match(text)[1] == t.to_s.u
+        end
+        ok
+      end
+    end
+    assert(threads.all? { |th| th.value })
+  end
 end
@@ -1,6 +1,22 @@
 #include "icu_common.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
 extern VALUE rb_cUString;
+extern VALUE rb_cUConverter;
 extern  VALUE icu_ustr_new_set(const UChar * str, long len, long capa);
+extern  UConverter * icu_cnv_checkout(const char * name, UErrorCode * status);
+extern  void icu_cnv_checkin(const char * name, UConverter * cnv);
+extern  const UCharsetMatch ** icu_cnv_detect_all(VALUE src, VALUE options, int32_t * count);
+extern  VALUE icu4r_cnv_detect(int argc, VALUE * argv, VALUE self);
+extern  int icu_parallel_p(long bytes);
+extern  int icu_cnv_policy(VALUE sym);
+extern  void icu_cnv_set_policy(UConverter * cnv, ICUCnvErrors * e, UErrorCode * status);
+extern  void icu_cnv_clear_policy(UConverter * cnv);
+extern  UChar * icu_cnv_to_uchars(UConverter * cnv, ICUCnvErrors * e, const char * src, long src_len, long * len, long * capa, UErrorCode * status);
+extern  UChar * icu_utf8_decode_parallel(const char * src, long src_len, long * len);
 
 /**
  * call-seq:
@@ -16,59 +32,80 @@ extern  VALUE icu_ustr_new_set(const UChar * str, long len, long capa);
 VALUE icu_ustr_from_array(obj)
 	VALUE		obj;
 {
-	int		i, n;
+	long		i, n;
 	VALUE		*p;
-	VALUE		ret, temp;
-	UChar32		* src , *pos, chr;
+	UChar32		chr;
 	UChar		* buf;
-	int32_t		len, capa;
-	UErrorCode	status = U_ZERO_ERROR;
+	int32_t		len, capa, pos;
 
 	n = RARRAY(obj)->len;
 	p = RARRAY(obj)->ptr;
 	
-	src = ALLOC_N(UChar32, n);
-	pos = src;
+	/* validate and count code units, to allocate buffer of exact size */
+	len = 0;
 	for ( i = 0; i < n; i++){
-	    temp = p[i];
-	    if(TYPE(temp) != T_FIXNUM) {
-	    	free(src);
-	    	rb_raise(rb_eTypeError, "Can't convert from %s", rb_class2name(CLASS_OF(temp)));
+	    if(TYPE(p[i]) != T_FIXNUM) {
+	    	rb_raise(rb_eTypeError, "Can't convert from %s", rb_class2name(CLASS_OF(p[i])));
 	    }
-	    chr = (UChar32) FIX2INT(temp);
+	    chr = (UChar32) FIX2INT(p[i]);
 	    // invalid codepoints are converted to U+FFFD
+	    len += U_IS_UNICODE_CHAR(chr) ? U16_LENGTH(chr) : 1;
+	}
+	capa = len + 1;
+	buf = ALLOC_N(UChar, capa);
+	pos = 0;
+	for ( i = 0; i < n; i++){
+	    chr = (UChar32) FIX2INT(p[i]);
 	    if( ! (U_IS_UNICODE_CHAR(chr)) ) {
 	    	chr = 0xFFFD;
 	    }
-	    *pos = chr;
-	    pos ++;
+	    U16_APPEND_UNSAFE(buf, pos, chr);
 	}
-	capa = n+1;
-	buf = ALLOC_N(UChar, capa);
-	u_strFromUTF32(buf, capa, &len, src, n, &status);
-	if( U_BUFFER_OVERFLOW_ERROR == status ){
-		capa = len+1;
-		REALLOC_N(buf, UChar, capa);
-		status = U_ZERO_ERROR;
-		u_strFromUTF32(buf, capa, &len, src, n, &status);
-	}
-	if (U_FAILURE(status) ) {
-		free(src);
-		free(buf);
-		rb_raise(rb_eRuntimeError, u_errorName(status));
-	}
-	if( capa <= len ){
-		++capa;
-		REALLOC_N(buf, UChar, capa);
-	}
-	ret = icu_ustr_new_set(buf, len, capa);
-	free(src);
-	return ret;
+	return icu_ustr_new_set(buf, len, capa);
+}
+
+/**
+ * Converts +src_len+ bytes of +src+ in given +encoding+ to UString,
+ * using converter from the pool. If +e+ is given, errors are handled
+ * by its policy instead of raising.
+ */
+VALUE icu_ustr_from_encoded(const char * encoding, const char * src, long src_len, ICUCnvErrors * e)
+{
+    UErrorCode      error = U_ZERO_ERROR;
+    long            capa, len;
+    UChar         * buf;
+    UConverter    * conv;
+
+    conv = icu_cnv_checkout(encoding, &error);
+    if (U_FAILURE(error)) {
+        rb_raise(rb_eArgError, u_errorName(error));
+    }
+    if( e ) icu_cnv_set_policy(conv, e, &error);
+    buf = icu_cnv_to_uchars(conv, e, src, src_len, &len, &capa, &error);
+    if( e ) icu_cnv_clear_policy(conv);
+    icu_cnv_checkin(encoding, conv);
+    if (U_FAILURE(error)) {
+        free(buf);
+        rb_raise(rb_eArgError, u_errorName(error));
+    }
+    return icu_ustr_new_set(buf, len, capa);
+}
+
+/* reads :on_error option into +e+, returns +e+ or NULL when not given */
+static ICUCnvErrors * icu_opt_errors(VALUE options, ICUCnvErrors * e)
+{
+    VALUE policy;
+    if( NIL_P(options) ) return NULL;
+    Check_Type(options, T_HASH);
+    policy = rb_hash_aref(options, ID2SYM(rb_intern("on_error")));
+    if( NIL_P(policy) ) return NULL;
+    e->policy = icu_cnv_policy(policy);
+    return e;
 }
 
 /**
  * call-seq:
- *    str.to_u(encoding = 'utf8') => String
+ *    str.to_u(encoding = 'utf8', options = {}) => String
  *
  * Converts String value in  given encoding to UString.
  * When no encoding is given, utf8 is assumed. If string is not valid UTF8,
@@ -76,6 +113,15 @@ VALUE icu_ustr_from_array(obj)
  *
  * When explicit encoding is given, converter will replace incorrect codepoints
  * with <U+FFFD> - replacement character.
+ *
+ * Option <tt>:on_error</tt> selects handling of malformed input for any encoding,
+ * without raising exception: <tt>:substitute</tt>, <tt>:skip</tt>, <tt>:escape</tt> or
+ * <tt>:stop</tt>, see UConverter#on_error=.
+ *
+ *      "ab\377c".to_u("utf8", :on_error => :escape)   # => "ab\\xFFc"
+ *
+ * UTF8 strings larger than UString.parallel_threshold are decoded
+ * in UString.parallel_threads threads.
  */
 VALUE
 icu_from_rstr(argc, argv, str)
@@ -83,52 +129,97 @@ icu_from_rstr(argc, argv, str)
      VALUE          *argv,
                      str;
 {
-    VALUE           enc;
+    VALUE           enc, options;
     char           *encoding = 0;	/* default */
     UErrorCode      error = 0;
     int32_t         capa, len;
-    VALUE s;
     UChar * buf;
-    UConverter * conv;
-    if (rb_scan_args(argc, argv, "01", &enc) == 1) {
+    long    plen;
+    ICUCnvErrors    errors, *e;
+    rb_scan_args(argc, argv, "02", &enc, &options);
+    if (TYPE(enc) == T_HASH && NIL_P(options)) {
+	options = enc;
+	enc = Qnil;
+    }
+    if (!NIL_P(enc)) {
 	Check_Type(enc, T_STRING);
 	encoding = RSTRING(enc)->ptr;
     } 
-    capa = RSTRING(str)->len + 1;
-    buf = ALLOC_N(UChar, capa);
+    e = icu_opt_errors(options, &errors);
 
     if(! encoding || !strncmp(encoding, "utf8", 4) ) {
       /* from UTF8 */
+        if( e ) return icu_ustr_from_encoded("UTF-8", RSTRING(str)->ptr, RSTRING(str)->len, e);
+        if( icu_parallel_p(RSTRING(str)->len) ) {
+	    /* on invalid input fall through to report error */
+	    buf = icu_utf8_decode_parallel(RSTRING(str)->ptr, RSTRING(str)->len, &plen);
+	    if( buf ) return icu_ustr_new_set(buf, plen, plen + 1);
+	}
+        capa = RSTRING(str)->len + 1;
+        buf = ALLOC_N(UChar, capa);
         u_strFromUTF8(buf, capa-1, &len, RSTRING(str)->ptr, RSTRING(str)->len, &error);
 	if( U_FAILURE(error)) {
 	   free(buf);
 	   rb_raise(rb_eArgError, u_errorName(error));
 	}
-	s = icu_ustr_new_set(buf, len, capa);
-    } else {
-          conv = ucnv_open(encoding, &error);
-          if (U_FAILURE(error)) {
-              ucnv_close(conv);
-              rb_raise(rb_eArgError, u_errorName(error));
-          }
-          len =  ucnv_toUChars(conv, buf, capa-1, RSTRING(str)->ptr,
-              	      RSTRING(str)->len, &error);
-          if (U_BUFFER_OVERFLOW_ERROR == error) {
-	      capa = len+1;
-              REALLOC_N(buf, UChar, capa);
-              error = 0;
-              len = ucnv_toUChars(conv, buf, capa-1, RSTRING(str)->ptr,
-              	      RSTRING(str)->len, &error);
-              if (U_FAILURE(error)) {
-		  free(buf);
-                  rb_raise(rb_eArgError, u_errorName(error));
-	      }
-  
-          }
-          s = icu_ustr_new_set(buf, len, capa);
-          ucnv_close(conv);
-    }
-    return s;
+	return icu_ustr_new_set(buf, len, capa);
+    } 
+    return icu_ustr_from_encoded(encoding, RSTRING(str)->ptr, RSTRING(str)->len, e);
+}
+
+/**
+ * call-seq:
+ *    str.detect_encoding(options = {}) => Array
+ *
+ * Guesses charset of this String, same as UConverter.detect(str, options).
+ */
+VALUE
+icu_rstr_detect(argc, argv, str)
+     int             argc;
+     VALUE          *argv,
+                     str;
+{
+    VALUE           args[2];
+    args[0] = str;
+    args[1] = Qnil;
+    rb_scan_args(argc, argv, "01", &args[1]);
+    return icu4r_cnv_detect(2, args, rb_cUConverter);
+}
+
+/**
+ * call-seq:
+ *    str.to_u_detect(options = {}) => UString
+ *
+ * Guesses charset of this String (see UConverter.detect for options)
+ * and converts it to UString using the best match. Option <tt>:on_error</tt>
+ * is handled as in String#to_u.
+ *
+ *     "\357\360\356\342\345\360\352\340 \357\360\356\342\345\360\352\340".to_u_detect   # => "проверка проверка"
+ */
+VALUE
+icu_from_rstr_detect(argc, argv, str)
+     int             argc;
+     VALUE          *argv,
+                     str;
+{
+    UErrorCode      status = U_ZERO_ERROR;
+    const UCharsetMatch ** matches;
+    char            encoding[UCNV_MAX_CONVERTER_NAME_LENGTH];
+    const char     *name;
+    int32_t         count;
+    VALUE           options = Qnil;
+    ICUCnvErrors    errors;
+    rb_scan_args(argc, argv, "01", &options);
+    matches = icu_cnv_detect_all(str, options, &count);
+    if( count == 0 ) 
+	rb_raise(rb_eArgError, "Can't detect encoding");
+    name = ucsdet_getName(matches[0], &status);
+    ICU_RAISE(status);
+    if( !name ) 
+	rb_raise(rb_eArgError, "Can't detect encoding");
+    strncpy(encoding, name, UCNV_MAX_CONVERTER_NAME_LENGTH - 1);
+    encoding[UCNV_MAX_CONVERTER_NAME_LENGTH - 1] = 0;
+    return icu_ustr_from_encoded(encoding, RSTRING(str)->ptr, RSTRING(str)->len, icu_opt_errors(options, &errors));
 }
 
 /**
@@ -156,6 +247,379 @@ icu_f_rb_str(argc, argv, obj)
     
 }
 
+/* --------- batch conversions */
+typedef struct {
+    VALUE          ary;
+    const char   * encoding;
+    long           count;
+    const char  ** src;
+    long         * src_len;
+    UChar       ** dest;	/* decoded buffers, NULL once owned by UString */
+    int32_t      * dest_len;
+    int32_t      * dest_capa;
+    UConverter   * conv;	/* NULL for UTF-8 */
+    long           failed;
+    UErrorCode     status;
+} ICUDecodeBatch;
+
+/* decodes all items, stops at the first failed one */
+static void icu_batch_decode(ICUDecodeBatch * b)
+{
+    long i;
+    int32_t len, capa;
+    UChar * buf;
+    for( i = 0; i < b->count; i++) {
+        b->status = U_ZERO_ERROR;
+        capa = b->src_len[i] + 1;
+        buf = ALLOC_N(UChar, capa);
+        if( b->conv ) {
+            len = ucnv_toUChars(b->conv, buf, capa-1, b->src[i], b->src_len[i], &b->status);
+            if( U_BUFFER_OVERFLOW_ERROR == b->status ) {
+                capa = len + 1;
+                REALLOC_N(buf, UChar, capa);
+                b->status = U_ZERO_ERROR;
+                len = ucnv_toUChars(b->conv, buf, capa-1, b->src[i], b->src_len[i], &b->status);
+            }
+        } else {
+            u_strFromUTF8(buf, capa-1, &len, b->src[i], b->src_len[i], &b->status);
+        }
+        b->dest[i] = buf;
+        if( U_FAILURE(b->status) ) {
+            b->failed = i;
+            return;
+        }
+        buf[len] = 0;
+        b->dest_len[i] = len;
+        b->dest_capa[i] = capa;
+    }
+}
+
+static VALUE icu_batch_decode_run(VALUE arg)
+{
+    ICUDecodeBatch * b = (ICUDecodeBatch *) arg;
+    UErrorCode status = U_ZERO_ERROR;
+    VALUE ret;
+    long i;
+    if( b->encoding && strncmp(b->encoding, "utf8", 4) ) {
+        b->conv = icu_cnv_checkout(b->encoding, &status);
+        if( U_FAILURE(status) ) rb_raise(rb_eArgError, u_errorName(status));
+    }
+    b->src       = ALLOC_N(const char *, b->count);
+    b->src_len   = ALLOC_N(long, b->count);
+    b->dest      = ALLOC_N(UChar *, b->count);
+    MEMZERO(b->dest, UChar *, b->count);
+    b->dest_len  = ALLOC_N(int32_t, b->count);
+    b->dest_capa = ALLOC_N(int32_t, b->count);
+    for( i = 0; i < b->count; i++) {
+        b->src[i] = RSTRING(RARRAY(b->ary)->ptr[i])->ptr;
+        b->src_len[i] = RSTRING(RARRAY(b->ary)->ptr[i])->len;
+    }
+
+    icu_batch_decode(b);
+
+    if( b->failed >= 0 ) 
+        rb_raise(rb_eArgError, "%s in item %ld", u_errorName(b->status), b->failed);
+    ret = rb_ary_new2(b->count);
+    for( i = 0; i < b->count; i++) {
+        rb_ary_store(ret, i, icu_ustr_new_set(b->dest[i], b->dest_len[i], b->dest_capa[i]));
+        b->dest[i] = NULL;
+    }
+    return ret;
+}
+
+/* releases converter and buffers, whether decoding succeeded or raised */
+static VALUE icu_batch_decode_done(VALUE arg)
+{
+    ICUDecodeBatch * b = (ICUDecodeBatch *) arg;
+    long i;
+    if( b->conv ) icu_cnv_checkin(b->encoding, b->conv);
+    if( b->dest ) 
+        for( i = 0; i < b->count; i++) free(b->dest[i]);
+    free(b->src); free(b->src_len); free(b->dest); free(b->dest_len); free(b->dest_capa);
+    return Qnil;
+}
+
+/**
+ * call-seq:
+ *     UString.decode_many(array, encoding = 'utf8') => array
+ *     ary.to_u_all(encoding = 'utf8')              => array
+ *
+ * Converts all Strings in array to UStrings in one call, using single converter.
+ * Invalid input raises ArgumentError, which tells index of failed item.
+ *
+ *      UString.decode_many(["abc", "где"])  # => ["abc", "где"]
+ */
+VALUE icu_ustr_decode_many(argc, argv, obj)
+	int		argc;
+	VALUE		*argv;
+	VALUE		obj;
+{
+	VALUE		ary, enc;
+	char		*encoding = 0;
+	ICUDecodeBatch	b;
+	long		i;
+
+	if( rb_scan_args(argc, argv, "11", &ary, &enc) == 2 ) {
+	    Check_Type(enc, T_STRING);
+	    encoding = RSTRING(enc)->ptr;
+	}
+	Check_Type(ary, T_ARRAY);
+	for( i = 0; i < RARRAY(ary)->len; i++) {
+	    Check_Type(RARRAY(ary)->ptr[i], T_STRING);
+	}
+	MEMZERO(&b, ICUDecodeBatch, 1);
+	b.ary = ary;
+	b.encoding = encoding;
+	b.count = RARRAY(ary)->len;
+	b.failed = -1;
+	b.status = U_ZERO_ERROR;
+	return rb_ensure(icu_batch_decode_run, (VALUE) &b, icu_batch_decode_done, (VALUE) &b);
+}
+
+VALUE icu_ary_to_u_all(argc, argv, ary)
+	int		argc;
+	VALUE		*argv;
+	VALUE		ary;
+{
+	VALUE		args[2];
+	args[0] = ary;
+	if( rb_scan_args(argc, argv, "01", &args[1]) == 1) 
+	    return icu_ustr_decode_many(2, args, rb_cUString);
+	return icu_ustr_decode_many(1, args, rb_cUString);
+}
+
+typedef struct {
+    VALUE           ary;
+    const char    * encoding;
+    long            count;
+    const UChar  ** src;
+    int32_t       * src_len;
+    int32_t       * bound;	/* max bytes for each item */
+    char          * arena;
+    long          * offset;	/* count + 1 entries */
+    UConverter    * conv;	/* NULL for UTF-8 */
+    long            failed;
+    UErrorCode      status;
+} ICUEncodeBatch;
+
+/* encodes all items into arena, stops at the first failed one */
+static void icu_batch_encode(ICUEncodeBatch * b)
+{
+    long i;
+    int32_t len, capa;
+    for( i = 0; i < b->count; i++) {
+        b->status = U_ZERO_ERROR;
+        capa = b->bound[i];
+        if( b->conv ) {
+            len = ucnv_fromUChars(b->conv, b->arena + b->offset[i], capa, b->src[i], b->src_len[i], &b->status);
+        } else {
+            u_strToUTF8(b->arena + b->offset[i], capa, &len, b->src[i], b->src_len[i], &b->status);
+        }
+        if( b->status == U_STRING_NOT_TERMINATED_WARNING ) b->status = U_ZERO_ERROR;
+        if( U_FAILURE(b->status) ) {
+            b->failed = i;
+            return;
+        }
+        b->offset[i+1] = b->offset[i] + len;
+    }
+}
+
+static VALUE icu_batch_encode_run(VALUE arg)
+{
+    ICUEncodeBatch * b = (ICUEncodeBatch *) arg;
+    UErrorCode status = U_ZERO_ERROR;
+    int8_t max_char = 3;	/* UTF-8: up to 3 bytes per UTF-16 unit */
+    long i, total = 0;
+    VALUE ret, str;
+    if( b->encoding && strncmp(b->encoding, "utf8", 4) ) {
+        b->conv = icu_cnv_checkout(b->encoding, &status);
+        if( U_FAILURE(status) ) rb_raise(rb_eArgError, u_errorName(status));
+        max_char = ucnv_getMaxCharSize(b->conv);
+    }
+    b->src     = ALLOC_N(const UChar *, b->count);
+    b->src_len = ALLOC_N(int32_t, b->count);
+    b->bound   = ALLOC_N(int32_t, b->count);
+    b->offset  = ALLOC_N(long, b->count + 1);
+    for( i = 0; i < b->count; i++) {
+        str = RARRAY(b->ary)->ptr[i];
+        b->src[i] = ICU_PTR(str);
+        b->src_len[i] = ICU_LEN(str);
+        b->bound[i] = UCNV_GET_MAX_BYTES_FOR_STRING(ICU_LEN(str), max_char);
+        total += b->bound[i];
+    }
+    b->offset[0] = 0;
+    b->arena = ALLOC_N(char, total + 1);
+
+    icu_batch_encode(b);
+
+    if( b->failed >= 0 ) 
+        rb_raise(rb_eArgError, "%s in item %ld", u_errorName(b->status), b->failed);
+    ret = rb_ary_new2(b->count);
+    for( i = 0; i < b->count; i++) {
+        rb_ary_store(ret, i, rb_str_new(b->arena + b->offset[i], b->offset[i+1] - b->offset[i]));
+    }
+    return ret;
+}
+
+static VALUE icu_batch_encode_done(VALUE arg)
+{
+    ICUEncodeBatch * b = (ICUEncodeBatch *) arg;
+    if( b->conv ) icu_cnv_checkin(b->encoding, b->conv);
+    free(b->src); free(b->src_len); free(b->bound); free(b->offset); free(b->arena);
+    return Qnil;
+}
+
+/**
+ * call-seq:
+ *     UString.encode_many(array, encoding = 'utf8') => array
+ *
+ * Converts all UStrings in array to Strings in given encoding in one call, 
+ * using single converter and output buffer. (inversion of UString.decode_many)
+ */
+VALUE icu_ustr_encode_many(argc, argv, obj)
+	int		argc;
+	VALUE		*argv;
+	VALUE		obj;
+{
+	VALUE		ary, enc;
+	char		*encoding = 0;
+	ICUEncodeBatch	b;
+	long		i;
+
+	if( rb_scan_args(argc, argv, "11", &ary, &enc) == 2 ) {
+	    Check_Type(enc, T_STRING);
+	    encoding = RSTRING(enc)->ptr;
+	}
+	Check_Type(ary, T_ARRAY);
+	for( i = 0; i < RARRAY(ary)->len; i++) {
+	    Check_Class(RARRAY(ary)->ptr[i], rb_cUString);
+	}
+	MEMZERO(&b, ICUEncodeBatch, 1);
+	b.ary = ary;
+	b.encoding = encoding;
+	b.count = RARRAY(ary)->len;
+	b.failed = -1;
+	b.status = U_ZERO_ERROR;
+	return rb_ensure(icu_batch_encode_run, (VALUE) &b, icu_batch_encode_done, (VALUE) &b);
+}
+
+/* --------- file decoding */
+#define FILE_CHUNK_SIZE (256 * 1024)
+
+/**
+ * call-seq:
+ *     UString.from_file(path, encoding = 'utf8') => UString
+ *
+ * Reads file in given encoding into UString. File is mapped into memory and 
+ * decoded in chunks directly into single UString buffer, so there is no 
+ * intermediate Ruby String; decoded parts of mapping are released as soon as possible. 
+ * For UTF-16 files in platform byte order, content is copied without conversion.
+ * Malformed UTF-8 raises ArgumentError when encoding is not given, as String#to_u does; 
+ * with explicit encoding it is substituted.
+ *
+ *     dict = UString.from_file("words.txt", "cp1251")
+ */
+VALUE icu_ustr_from_file(argc, argv, obj)
+	int		argc;
+	VALUE		*argv;
+	VALUE		obj;
+{
+	VALUE		path, enc;
+	char		*encoding = "utf8";
+	const char	*native_utf16 = U_IS_BIG_ENDIAN ? "UTF-16BE" : "UTF-16LE";
+	const char	*map, *src, *src_end, *chunk_end;
+	UChar		*buf, *target;
+	long		capa, len, size, dropped = 0;
+	struct stat	st;
+	int		fd, err, strict = 1;
+	UConverter	*conv;
+	UErrorCode	status = U_ZERO_ERROR;
+
+	if( rb_scan_args(argc, argv, "11", &path, &enc) == 2 ) {
+	    Check_Type(enc, T_STRING);
+	    encoding = RSTRING(enc)->ptr;
+	    strict = 0;
+	}
+	Check_Type(path, T_STRING);
+	conv = icu_cnv_checkout(encoding, &status);
+	if( U_FAILURE(status) ) rb_raise(rb_eArgError, u_errorName(status));
+
+	fd = open(RSTRING(path)->ptr, O_RDONLY);
+	if( fd < 0 || fstat(fd, &st) < 0 ) {
+	    err = errno;
+	    if( fd >= 0 ) close(fd);
+	    icu_cnv_checkin(encoding, conv);
+	    errno = err;
+	    rb_sys_fail(RSTRING(path)->ptr);
+	}
+	size = st.st_size;
+	if( size == 0 ) {
+	    close(fd);
+	    icu_cnv_checkin(encoding, conv);
+	    return icu_ustr_new_set(ALLOC_N(UChar, 1), 0, 1);
+	}
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	err = errno;
+	close(fd);
+	if( map == MAP_FAILED ) {
+	    icu_cnv_checkin(encoding, conv);
+	    errno = err;
+	    rb_sys_fail(RSTRING(path)->ptr);
+	}
+	madvise((void *)map, size, MADV_SEQUENTIAL);
+	if( strict ) {
+	    ucnv_setToUCallBack(conv, UCNV_TO_U_CALLBACK_STOP, NULL, NULL, NULL, &status);
+	    status = U_ZERO_ERROR;
+	}
+
+	if( !strcmp(ucnv_getName(conv, &status), native_utf16) && size % sizeof(UChar) == 0 ) {
+	    /* same layout as UString buffer */
+	    len  = size / sizeof(UChar);
+	    capa = len + 1;
+	    buf  = ALLOC_N(UChar, capa);
+	    memcpy(buf, map, size);
+	} else {
+	    /* for single and multibyte charsets UTF-16 text is not longer than source */
+	    capa = (!strncmp(ucnv_getName(conv, &status), "UTF-16", 6) ||
+	            !strncmp(ucnv_getName(conv, &status), "UTF-32", 6)) ? size / 2 + 1 : size + 1;
+	    buf = ALLOC_N(UChar, capa);
+	    target = buf;
+	    src = map;
+	    src_end = map + size;
+	    do {
+	        chunk_end = src_end - src > FILE_CHUNK_SIZE ? src + FILE_CHUNK_SIZE : src_end;
+	        status = U_ZERO_ERROR;
+	        ucnv_toUnicode(conv, &target, buf + capa - 1, &src, chunk_end, NULL, chunk_end == src_end, &status);
+	        if( status == U_BUFFER_OVERFLOW_ERROR ) {
+	            len  = target - buf;
+	            capa = capa * 2;
+	            REALLOC_N(buf, UChar, capa);
+	            target = buf + len;
+	            continue;
+	        }
+	        if( U_FAILURE(status) ) break;
+	        /* decoded pages won't be needed again */
+	        if( src - map - dropped >= FILE_CHUNK_SIZE ) {
+	            madvise((void *)(map + dropped), FILE_CHUNK_SIZE, MADV_DONTNEED);
+	            dropped += FILE_CHUNK_SIZE;
+	        }
+	    } while( src < src_end || status == U_BUFFER_OVERFLOW_ERROR );
+	    len = target - buf;
+	}
+	munmap((void *)map, size);
+	if( strict ) icu_cnv_clear_policy(conv);
+	icu_cnv_checkin(encoding, conv);
+	if( U_FAILURE(status) ) {
+	    free(buf);
+	    rb_raise(rb_eArgError, u_errorName(status));
+	}
+	if( capa - len > 1024 ) {
+	    capa = len + 1;
+	    REALLOC_N(buf, UChar, capa);
+	}
+	return icu_ustr_new_set(buf, len, capa);
+}
+
 void initialize_ucore_ext(void) 
 {
     /* conversion from String to UString */
@@ -163,6 +627,18 @@ void initialize_ucore_ext(void)
     rb_define_alias(rb_cString, "u", "to_u");
     rb_define_global_function("u", icu_f_rb_str, -1);
 
+    /* charset detection */
+    rb_define_method(rb_cString, "detect_encoding", icu_rstr_detect, -1);
+    rb_define_method(rb_cString, "to_u_detect", icu_from_rstr_detect, -1);
+
     /* conversion from Array to UString */
     rb_define_method(rb_cArray, "to_u", icu_ustr_from_array, 0);
+
+    /* batch conversions */
+    rb_define_method(rb_cArray, "to_u_all", icu_ary_to_u_all, -1);
+    rb_define_singleton_method(rb_cUString, "decode_many", icu_ustr_decode_many, -1);
+    rb_define_singleton_method(rb_cUString, "encode_many", icu_ustr_encode_many, -1);
+
+    /* file decoding */
+    rb_define_singleton_method(rb_cUString, "from_file", icu_ustr_from_file, -1);
 }
@@ -0,0 +1,287 @@
+/**
+ * Document-class: UReader
+ *
+ * UReader reads text from IO in pieces: bytes are decoded with a pooled converter,
+ * split by break iterator and optionally normalized, so only a read buffer and a
+ * current segment are kept in memory, regardless of the input size.
+ *
+ *      File.open("big.log") do |f|
+ *        UReader.new(f, :break => :sentence, :normalize => :nfc).each { |s| ... }
+ *      end
+ */
+#include "icu_common.h"
+extern VALUE rb_cUReader;
+extern VALUE icu_ustr_new(const UChar * ptr, long len);
+extern VALUE icu_ustr_normalize(VALUE str, int32_t mode);
+extern UConverter * icu_cnv_checkout(const char * name, UErrorCode * status);
+extern void icu_cnv_checkin(const char * name, UConverter * cnv);
+
+#define READER_BUF_SIZE  65536
+/* boundary is trusted only when this many units follow it, or at EOF */
+#define READER_LOOKAHEAD 256
+
+typedef struct {
+    VALUE            io;
+    char             encoding[UCNV_MAX_CONVERTER_NAME_LENGTH];
+    UConverter     * cnv;
+    UBreakIterator * brk;
+    UNormalizationMode norm;
+    long             buf_size;	/* bytes per read */
+    UChar          * text;	/* decoded text, text[start..len) is not returned yet */
+    long             start, len, capa;
+    long             base;	/* stream offset of text[0] */
+    int              eof;
+} ICUReader;
+
+#define UREADER(obj) ((ICUReader *)DATA_PTR(obj))
+
+static void icu_reader_release(ICUReader * r)
+{
+    if( r->brk ) ubrk_close(r->brk);
+    if( r->cnv ) icu_cnv_checkin(r->encoding, r->cnv);
+    r->brk = NULL;
+    r->cnv = NULL;
+}
+
+static void icu_reader_mark(ICUReader * r)
+{
+    rb_gc_mark(r->io);
+}
+
+static void icu_reader_free(ICUReader * r)
+{
+    icu_reader_release(r);
+    free(r->text);
+    free(r);
+}
+
+static VALUE icu_reader_alloc(VALUE klass)
+{
+    ICUReader * r = ALLOC(ICUReader);
+    MEMZERO(r, ICUReader, 1);
+    r->io = Qnil;
+    return Data_Wrap_Struct(klass, icu_reader_mark, icu_reader_free, r);
+}
+
+/* maps option value to one of given names, returns its index */
+static int icu_reader_opt(VALUE options, const char * key, const char ** names, int n, int def)
+{
+    VALUE val = rb_hash_aref(options, ID2SYM(rb_intern(key)));
+    const char * name;
+    int i;
+    if( NIL_P(val) ) return def;
+    Check_Type(val, T_SYMBOL);
+    name = rb_id2name(SYM2ID(val));
+    for( i = 0; i < n; i++) {
+        if( !strcmp(name, names[i]) ) return i;
+    }
+    rb_raise(rb_eArgError, "Unknown %s: %s", key, name);
+    return def;
+}
+
+/**
+ * call-seq:
+ *     UReader.new(io, options = {})
+ *
+ * Creates reader over +io+, which must respond to <code>read(size)</code>. Valid options are:
+ *
+ *      :encoding    -- encoding of input, default 'utf8'. Malformed bytes are replaced with U+FFFD.
+ *      :break       -- segments to return: :line (line break opportunities, default),
+ *                      :sentence, :word or :char
+ *      :locale      -- locale for break iterator, default ""
+ *      :normalize   -- :nfc, :nfd, :nfkc or :nfkd, to normalize each segment; default is none
+ *      :buffer_size -- bytes to read at once, default 65536
+ *
+ * Break rules never split a combining sequence, so normalizing segments one by one
+ * gives the same text as normalizing the whole input.
+ */
+VALUE icu_reader_init(int argc, VALUE * argv, VALUE self)
+{
+    static const char * breaks[] = { "char", "word", "line", "sentence" };
+    static const int    brk_types[] = { UBRK_CHARACTER, UBRK_WORD, UBRK_LINE, UBRK_SENTENCE };
+    static const char * norms[] = { "none", "nfc", "nfd", "nfkc", "nfkd" };
+    static const UNormalizationMode norm_modes[] = { UNORM_NONE, UNORM_NFC, UNORM_NFD, UNORM_NFKC, UNORM_NFKD };
+    ICUReader * r = UREADER(self);
+    UErrorCode status = U_ZERO_ERROR;
+    VALUE io, options, val;
+    const char * encoding = "utf8", * locale = "";
+    int brk = 2;
+
+    rb_scan_args(argc, argv, "11", &io, &options);
+    r->io = io;
+    r->buf_size = READER_BUF_SIZE;
+    r->norm = UNORM_NONE;
+    if( !NIL_P(options) ) {
+        Check_Type(options, T_HASH);
+        val = rb_hash_aref(options, ID2SYM(rb_intern("encoding")));
+        if( !NIL_P(val) ) {
+            Check_Type(val, T_STRING);
+            encoding = RSTRING(val)->ptr;
+        }
+        val = rb_hash_aref(options, ID2SYM(rb_intern("locale")));
+        if( !NIL_P(val) ) {
+            Check_Type(val, T_STRING);
+            locale = RSTRING(val)->ptr;
+        }
+        val = rb_hash_aref(options, ID2SYM(rb_intern("buffer_size")));
+        if( !NIL_P(val) ) {
+            Check_Type(val, T_FIXNUM);
+            r->buf_size = FIX2LONG(val);
+            if( r->buf_size <= 0 ) rb_raise(rb_eArgError, "Buffer size must be positive, got: %ld", r->buf_size);
+        }
+        brk = icu_reader_opt(options, "break", breaks, 4, 2);
+        r->norm = norm_modes[icu_reader_opt(options, "normalize", norms, 5, 0)];
+    }
+    if( strlen(encoding) >= UCNV_MAX_CONVERTER_NAME_LENGTH )
+        rb_raise(rb_eArgError, "Converter name is too long");
+    icu_reader_release(r);
+    /* drop text of previous stream, if reader is initialized again */
+    free(r->text);
+    r->text = NULL;
+    r->start = r->len = r->capa = r->base = 0;
+    r->eof = 0;
+    strcpy(r->encoding, encoding);
+    r->cnv = icu_cnv_checkout(encoding, &status);
+    if( U_FAILURE(status) ) rb_raise(rb_eArgError, u_errorName(status));
+    r->brk = ubrk_open(brk_types[brk], locale, NULL, 0, &status);
+    if( U_FAILURE(status) ) rb_raise(rb_eArgError, u_errorName(status));
+    return self;
+}
+
+/* reads and decodes next piece of input, dropping returned text */
+static void icu_reader_fill(ICUReader * r)
+{
+    UErrorCode status, brk_status = U_ZERO_ERROR;
+    VALUE chunk;
+    const char * src, * src_end;
+    UChar * target;
+    long need;
+    UBool flush;
+
+    chunk = rb_funcall(r->io, rb_intern("read"), 1, LONG2NUM(r->buf_size));
+    if( !NIL_P(chunk) ) Check_Type(chunk, T_STRING);
+    flush = NIL_P(chunk) || RSTRING(chunk)->len == 0;
+    /* io#read may have closed the reader */
+    if( !r->cnv ) rb_raise(rb_eIOError, "closed reader");
+
+    if( r->start > 0 ) {
+        MEMMOVE(r->text, r->text + r->start, UChar, r->len - r->start);
+        r->len -= r->start;
+        r->base += r->start;
+        r->start = 0;
+        /* break iterator must not see moved text, even if following code raises */
+        ubrk_setText(r->brk, r->text, r->len, &brk_status);
+    }
+    src = flush ? NULL : RSTRING(chunk)->ptr;
+    src_end = flush ? NULL : src + RSTRING(chunk)->len;
+    need = r->len + (src_end - src) + 16;
+    if( need > r->capa ) {
+        r->capa = need;
+        REALLOC_N(r->text, UChar, r->capa);
+    }
+    do {
+        status = U_ZERO_ERROR;
+        target = r->text + r->len;
+        ucnv_toUnicode(r->cnv, &target, r->text + r->capa, &src, src_end, NULL, flush, &status);
+        r->len = target - r->text;
+        if( status == U_BUFFER_OVERFLOW_ERROR ) {
+            r->capa *= 2;
+            REALLOC_N(r->text, UChar, r->capa);
+        }
+    } while( status == U_BUFFER_OVERFLOW_ERROR );
+    brk_status = U_ZERO_ERROR;
+    ubrk_setText(r->brk, r->text, r->len, &brk_status);
+    if( U_FAILURE(status) ) rb_raise(rb_eArgError, u_errorName(status));
+    r->eof = flush;
+    ICU_RAISE(brk_status);
+}
+
+/**
+ * call-seq:
+ *     reader.next # => UString or nil
+ *
+ * Returns next segment of text, or nil at the end of input.
+ * Input is read only when buffered text doesn't contain a complete segment.
+ */
+VALUE icu_reader_next(VALUE self)
+{
+    ICUReader * r = UREADER(self);
+    UErrorCode status = U_ZERO_ERROR;
+    long end, n;
+    const UChar * p;
+    if( !r->cnv ) rb_raise(rb_eIOError, "closed reader");
+    for(;;) {
+        if( r->start < r->len ) {
+            end = ubrk_following(r->brk, r->start);
+            if( end == UBRK_DONE ) end = r->len;
+            if( r->eof || r->len - end >= READER_LOOKAHEAD ) break;
+        } else if( r->eof ) {
+            return Qnil;
+        }
+        icu_reader_fill(r);
+    }
+    p = r->text + r->start;
+    n = end - r->start;
+    r->start = end;
+    if( r->norm != UNORM_NONE && UNORM_YES != unorm_quickCheck(p, n, r->norm, &status) )
+        return icu_ustr_normalize(icu_ustr_new(p, n), r->norm);
+    return icu_ustr_new(p, n);
+}
+
+/**
+ * call-seq:
+ *     reader.each {|segment| block } => reader
+ *
+ * Yields segments of text until the end of input.
+ */
+VALUE icu_reader_each(VALUE self)
+{
+    VALUE seg;
+#ifdef RETURN_ENUMERATOR
+    RETURN_ENUMERATOR(self, 0, 0);
+#endif
+    while( !NIL_P(seg = icu_reader_next(self)) ) {
+        rb_yield(seg);
+    }
+    return self;
+}
+
+/**
+ * call-seq:
+ *     reader.pos # => Fixnum
+ *
+ * Offset of the next segment in decoded (not normalized) text, in code units.
+ */
+VALUE icu_reader_pos(VALUE self)
+{
+    ICUReader * r = UREADER(self);
+    return LONG2NUM(r->base + r->start);
+}
+
+/**
+ * call-seq:
+ *     reader.close
+ *
+ * Releases converter and break iterator. Underlying IO is not closed.
+ */
+VALUE icu_reader_close(VALUE self)
+{
+    ICUReader * r = UREADER(self);
+    icu_reader_release(r);
+    free(r->text);
+    r->text = NULL;
+    r->start = r->len = r->capa = 0;
+    return Qnil;
+}
+
+void initialize_ureader(void)
+{
+    rb_cUReader = rb_define_class("UReader", rb_cObject);
+    rb_include_module(rb_cUReader, rb_mEnumerable);
+    rb_define_alloc_func(rb_cUReader, icu_reader_alloc);
+    rb_define_method(rb_cUReader, "initialize", icu_reader_init, -1);
+    rb_define_method(rb_cUReader, "next", icu_reader_next, 0);
+    rb_define_method(rb_cUReader, "each", icu_reader_each, 0);
+    rb_define_method(rb_cUReader, "pos", icu_reader_pos, 0);
+    rb_define_method(rb_cUReader, "close", icu_reader_close, 0);
+}
@@ -26,11 +26,13 @@
 extern VALUE rb_cURegexp;
 extern VALUE rb_cUString;
 extern VALUE rb_cUMatch;
+extern VALUE rb_cUReplacement;
 VALUE           icu_umatch_aref(VALUE match, VALUE idx);
-VALUE           icu_umatch_new (VALUE re);
+VALUE           icu_umatch_new (VALUE re, VALUE str);
 extern VALUE icu_ustr_new(const UChar * ptr, long len);
 extern VALUE icu_ustr_new2(const UChar * ptr);
-extern void ustr_splice_units(ICUString * str, long start, long del_len, const UChar * replacement, long repl_len);
+extern void ustr_append_units(ICUString * str, const UChar * p, long n);
+extern void ustr_capa_resize(ICUString * str, long new_capa);
 extern VALUE icu_from_rstr(int, VALUE *, VALUE);
 
 /* --------- regular expressions */
@@ -38,6 +40,8 @@ void icu_regex_free( ICURegexp      *ptr)
 {
     if (ptr->pattern)
 	uregex_close(ptr->pattern);
+    if (ptr->idle)
+	uregex_close(ptr->idle);
     ptr->pattern = 0;
     free(ptr);
 }
@@ -48,9 +52,92 @@ icu_reg_s_alloc(klass)
 {
     ICURegexp      *ptr = ALLOC_N(ICURegexp, 1);
     ptr->pattern = 0;
+    ptr->idle = 0;
     return Data_Wrap_Struct(klass, 0, icu_regex_free, ptr);
 }
 
+/* --------- cache of compiled patterns, LRU */
+#define REG_CACHE_SIZE 32
+#define REG_KEY_UCHARS 0	/* key is UTF-16 pattern */
+#define REG_KEY_UTF8   1	/* key is UTF-8 source of Ruby Regexp */
+
+typedef struct {
+    char               *key;
+    long                key_len;
+    int                 kind;
+    int                 flags;
+    unsigned long       used;
+    URegularExpression *re;	/* never matched, only cloned */
+} ICURegexpSlot;
+
+static ICURegexpSlot s_reg_cache[REG_CACHE_SIZE];
+static unsigned long s_reg_tick = 0;
+
+/**
+ * Returns new matcher, cloned from cached pattern with given key, or NULL.
+ */
+static URegularExpression *
+icu_reg_cache_get(key, key_len, kind, flags)
+     const char     *key;
+     long            key_len;
+     int             kind, flags;
+{
+    UErrorCode      status = U_ZERO_ERROR;
+    URegularExpression *re;
+    int             i;
+    for (i = 0; i < REG_CACHE_SIZE; i++) {
+	ICURegexpSlot  *slot = s_reg_cache + i;
+	if (slot->re && slot->key_len == key_len && slot->kind == kind && slot->flags == flags
+	    && !memcmp(slot->key, key, key_len)) {
+	    re = uregex_clone(slot->re, &status);
+	    if (U_FAILURE(status))
+		return NULL;
+	    slot->used = ++s_reg_tick;
+	    return re;
+	}
+    }
+    return NULL;
+}
+
+/**
+ * Stores clone of +re+ in cache, replacing least recently used entry.
+ */
+static void
+icu_reg_cache_put(key, key_len, kind, flags, re)
+     const char     *key;
+     long            key_len;
+     int             kind, flags;
+     URegularExpression *re;
+{
+    UErrorCode      status = U_ZERO_ERROR;
+    ICURegexpSlot  *slot = s_reg_cache;
+    char           *copy;
+    int             i;
+    for (i = 1; i < REG_CACHE_SIZE && slot->re; i++) {
+	if (!s_reg_cache[i].re || s_reg_cache[i].used < slot->used)
+	    slot = s_reg_cache + i;
+    }
+    copy = malloc(key_len + 1);
+    if (!copy)
+	return;
+    re = uregex_clone(re, &status);
+    if (U_FAILURE(status)) {
+	free(copy);
+	return;
+    }
+    if (slot->re) {
+	uregex_close(slot->re);
+	free(slot->key);
+    }
+    memcpy(copy, key, key_len);
+    slot->key = copy;
+    slot->key_len = key_len;
+    slot->kind = kind;
+    slot->flags = flags;
+    slot->used = ++s_reg_tick;
+    slot->re = re;
+}
+
 void
 icu_reg_initialize(obj, s, len, options)
      VALUE           obj;
@@ -64,8 +151,16 @@ icu_reg_initialize(obj, s, len, options)
 
     if (re->pattern)
 	uregex_close(re->pattern);
-    re->pattern = uregex_open(s, len, options, &pe, &status);
+    if (re->idle)
+	uregex_close(re->idle);
+    re->idle = 0;
     re->options = options;
+    re->pattern = icu_reg_cache_get((const char *) s, len * sizeof(UChar), REG_KEY_UCHARS, options);
+    if (re->pattern)
+	return;
+    re->pattern = uregex_open(s, len, options, &pe, &status);
+    if (U_SUCCESS(status))
+	icu_reg_cache_put((const char *) s, len * sizeof(UChar), REG_KEY_UCHARS, options, re->pattern);
 
     if (U_FAILURE(status))
 	rb_raise(rb_eArgError,
@@ -137,23 +232,42 @@ icu_reg_new(s, len, options)
     return (VALUE) re;
 }
 
-VALUE 
-icu_reg_clone(obj)
-      VALUE       obj;
-{
-      ICURegexp      *regex = UREGEX(obj);
-      URegularExpression *old_pattern = UREGEX(obj)->pattern;
-      VALUE           ret ;
-      UErrorCode      status = U_ZERO_ERROR;
-      URegularExpression * new_pattern = uregex_clone(regex->pattern, &status);
-       if(U_FAILURE(status) ){
-        rb_raise(rb_eArgError, u_errorName(status));
-      }
-      ret = icu_reg_s_alloc(rb_cURegexp);
-      regex = UREGEX(ret);
-      regex->pattern = old_pattern;
-      UREGEX(obj)->pattern = new_pattern;
-      return ret;
+/**
+ * Returns matcher for one operation on +re+: URegexp, which pattern is
+ * taken from idle slot of +re+ or cloned. Compiled pattern of +re+ is never
+ * matched itself, so URegexp may be shared between threads and used again
+ * from within gsub block. Matcher should be given back with icu_reg_release,
+ * if operation raises, it is left to GC.
+ */
+VALUE
+icu_reg_matcher(re)
+     VALUE           re;
+{
+    ICURegexp      *regex = UREGEX(re);
+    VALUE           ret = icu_reg_s_alloc(rb_cURegexp);
+    UErrorCode      status = U_ZERO_ERROR;
+    if (regex->idle) {
+	UREGEX(ret)->pattern = regex->idle;
+	regex->idle = 0;
+    } else {
+	UREGEX(ret)->pattern = uregex_clone(regex->pattern, &status);
+	if (U_FAILURE(status))
+	    rb_raise(rb_eArgError, u_errorName(status));
+    }
+    UREGEX(ret)->options = regex->options;
+    return ret;
+}
+
+void
+icu_reg_release(re, matcher)
+     VALUE           re,
+                     matcher;
+{
+    ICURegexp      *regex = UREGEX(re);
+    if (!regex->idle) {
+	regex->idle = UREGEX(matcher)->pattern;
+	UREGEX(matcher)->pattern = 0;
+    }
 }
 VALUE
 icu_reg_comp(str)
@@ -172,7 +286,18 @@ icu_reg_comp(str)
 VALUE icu_reg_from_rb_reg(re)
       VALUE          re;
 {
-    return icu_reg_comp(icu_from_rstr(0, NULL, rb_funcall(re, rb_intern("to_s"), 0)));
+    VALUE           src = rb_funcall(re, rb_intern("to_s"), 0), ret;
+    URegularExpression *pattern;
+    pattern = icu_reg_cache_get(RSTRING(src)->ptr, RSTRING(src)->len, REG_KEY_UTF8, 0);
+    if (pattern) {
+	ret = icu_reg_s_alloc(rb_cURegexp);
+	UREGEX(ret)->pattern = pattern;
+	UREGEX(ret)->options = 0;
+	return ret;
+    }
+    ret = icu_reg_comp(icu_from_rstr(0, NULL, src));
+    icu_reg_cache_put(RSTRING(src)->ptr, RSTRING(src)->len, REG_KEY_UTF8, 0, UREGEX(ret)->pattern);
+    return ret;
 }
 
 /**
@@ -204,14 +329,16 @@ icu_reg_split(self, str, limit)
                      str,
                      limit;
 {
-    VALUE splits;
-    URegularExpression *theRegEx = UREGEX(self)->pattern;
+    VALUE splits, matcher;
+    URegularExpression *theRegEx;
     UErrorCode      error = U_ZERO_ERROR;
     UChar * dest_buf, **dest_fields;
     int32_t limt, req_cap, total, i;
     Check_Class(str, rb_cUString);
     if (limit != Qnil)
 	Check_Type(limit, T_FIXNUM);
+    matcher = icu_reg_matcher(self);
+    theRegEx = UREGEX(matcher)->pattern;
     dest_buf = ALLOC_N(UChar, USTRING(str)->len * 2 + 2);
     limt = (limit == Qnil ? USTRING(str)->len + 1 : FIX2INT(limit));
     dest_fields = ALLOC_N(UChar *, limt);
@@ -241,10 +368,11 @@ icu_reg_split(self, str, limit)
     
     	free(dest_buf);
 	free(dest_fields);
-
+    icu_reg_release(self, matcher);
     return splits;
 }
 
+/* +re+ is a matcher, see icu_reg_matcher */
 long
 icu_reg_search(re, str, pos, reverse)
      VALUE           re,
@@ -352,15 +480,18 @@ icu_reg_match(re, str)
                      str;
 {
     UErrorCode      error = U_ZERO_ERROR;
+    VALUE           matcher, ret = Qnil;
     Check_Class(str, rb_cUString);
-    uregex_setText(UREGEX(re)->pattern, USTRING(str)->ptr,
+    matcher = icu_reg_matcher(re);
+    uregex_setText(UREGEX(matcher)->pattern, USTRING(str)->ptr,
 		   USTRING(str)->len, &error);
     if (U_FAILURE(error))
 	rb_raise(rb_eArgError, u_errorName(error));
-    if (uregex_find(UREGEX(re)->pattern, 0, &error)) {
-	return icu_umatch_new(re);
+    if (uregex_find(UREGEX(matcher)->pattern, 0, &error)) {
+	ret = icu_umatch_new(matcher, str);
     }
-    return Qnil;
+    icu_reg_release(re, matcher);
+    return ret;
 }
 
 /**
@@ -386,8 +517,11 @@ icu_reg_eqq(re, str)
                      str;
 {
     long            start;
+    VALUE           matcher;
     Check_Class(str, rb_cUString);
-    start = icu_reg_search(re, str, 0, 0);
+    matcher = icu_reg_matcher(re);
+    start = icu_reg_search(matcher, str, 0, 0);
+    icu_reg_release(re, matcher);
     return start < 0 ? Qfalse : Qtrue;
 }
 
@@ -406,24 +540,100 @@ icu_reg_find_next(pat)
 static const UChar BACKSLASH  = 0x5c;
 static const UChar DOLLARSIGN = 0x24;
 
+/* --------- replacement templates */
+typedef struct {
+    int32_t         group;	/* capture group number, -1 for literal text */
+    int32_t         start;	/* literal text in ICUReplacement->text */
+    int32_t         len;
+} ICUReplSegment;
+
+typedef struct {
+    VALUE           source;	/* UString it was parsed from */
+    UChar          *text;	/* unescaped literal text of all segments */
+    int32_t         text_len;
+    long            count;
+    long            refs;	/* segments with group */
+    ICUReplSegment *seg;
+} ICUReplacement;
+
+#define UREPL(obj) ((ICUReplacement *)DATA_PTR(obj))
+
+static void
+icu_repl_mark(r)
+     ICUReplacement *r;
+{
+    rb_gc_mark(r->source);
+}
+
+static void
+icu_repl_free(r)
+     ICUReplacement *r;
+{
+    if (r->text)
+	free(r->text);
+    if (r->seg)
+	free(r->seg);
+    free(r);
+}
+
 VALUE
-icu_reg_get_replacement(pat, repl_text, prev_end)
-     VALUE           pat,
+icu_repl_s_alloc(klass)
+     VALUE           klass;
+{
+    ICUReplacement *r = ALLOC_N(ICUReplacement, 1);
+    r->source = Qnil;
+    r->text = 0;
+    r->text_len = 0;
+    r->count = 0;
+    r->refs = 0;
+    r->seg = 0;
+    return Data_Wrap_Struct(klass, icu_repl_mark, icu_repl_free, r);
+}
+
+/* adds literal char to template, merging it with previous literal */
+static void
+icu_repl_add_char(r, c)
+     ICUReplacement *r;
+     UChar           c;
+{
+    ICUReplSegment *last = r->count ? r->seg + r->count - 1 : 0;
+    if (!last || last->group != -1) {
+	last = r->seg + r->count++;
+	last->group = -1;
+	last->start = r->text_len;
+	last->len = 0;
+    }
+    r->text[r->text_len++] = c;
+    last->len++;
+}
+
+/* parses +repl_text+ into template, keeping reference to it */
+static VALUE
+icu_repl_parse(self, repl_text)
+     VALUE           self,
                      repl_text;
-     long            prev_end;
 {
-    UErrorCode      error = U_ZERO_ERROR;
-    URegularExpression *the_expr = UREGEX(pat)->pattern;
-    VALUE 	    ret = icu_ustr_new(0, 0);
-    
+    ICUReplacement *r = UREPL(self);
     /* scan the replacement text, looking for substitutions ($n) and \escapes. */
     int32_t  replIdx = 0;
-    int32_t  replacementLength = ICU_LEN(repl_text);
-    UChar    *replacementText = ICU_PTR(repl_text);
+    int32_t  replacementLength;
+    UChar    *replacementText;
     int32_t numDigits = 0;
-    int32_t groupNum  = 0, g_start, g_end;
+    int32_t groupNum  = 0;
     UChar32 digitC;
-    int32_t len;
+    Check_Class(repl_text, rb_cUString);
+    replacementLength = ICU_LEN(repl_text);
+    replacementText = ICU_PTR(repl_text);
+    if (r->text)
+	free(r->text);
+    if (r->seg)
+	free(r->seg);
+    r->count = 0;
+    r->refs = 0;
+    r->text_len = 0;
+    r->source = repl_text;
+    r->text = ALLOC_N(UChar, replacementLength + 1);
+    r->seg = ALLOC_N(ICUReplSegment, replacementLength + 1);
     /* following code is rewritten version of code found  */
     /* in ICU sources : i18n/regexp.cpp */
     while (replIdx < replacementLength) {
@@ -431,8 +641,8 @@ icu_reg_get_replacement(pat, repl_text, prev_end)
         replIdx++;
         if (c != DOLLARSIGN && c != BACKSLASH) {
             /* Common case, no substitution, no escaping,  */
-            /*  just copy the char to the dest buf. */
-            ustr_splice_units(USTRING(ret), ICU_LEN(ret), 0, replacementText+replIdx-1, 1);
+            /*  just copy the char to the template. */
+            icu_repl_add_char(r, c);
             continue;
         }
 
@@ -448,7 +658,7 @@ icu_reg_get_replacement(pat, repl_text, prev_end)
             /* ICU4R : \uxxxx case is removed for simplicity : if (c==0x55 || c==0x75) { */
 
             /* Plain backslash escape.  Just put out the escaped character. */
-	    ustr_splice_units(USTRING(ret), ICU_LEN(ret), 0, replacementText+replIdx, 1);
+	    icu_repl_add_char(r, replacementText[replIdx]);
             replIdx++;
             continue;
         }
@@ -479,49 +689,191 @@ icu_reg_get_replacement(pat, repl_text, prev_end)
         if (numDigits == 0) {
             /* The $ didn't introduce a group number at all. */
             /* Treat it as just part of the substitution text. */
-	    ustr_splice_units(USTRING(ret), ICU_LEN(ret), 0, &DOLLARSIGN, 1);
+	    icu_repl_add_char(r, DOLLARSIGN);
             continue;
         }
 
-        /* Finally, append the capture group data to the destination. */
-	error = U_ZERO_ERROR;
-	g_start = uregex_start(the_expr, groupNum, &error);
-	g_end   = uregex_end  (the_expr, groupNum, &error);
-	if(U_SUCCESS(error) && g_start != -1  ) {
-	   ustr_splice_units(USTRING(ret), ICU_LEN(ret), 0, 
-	    uregex_getText(the_expr, &len, &error) + g_start, g_end - g_start);
-	}
-
+        /* Finally, reference to the capture group. */
+	r->seg[r->count].group = groupNum;
+	r->seg[r->count].start = 0;
+	r->seg[r->count].len = 0;
+	r->count++;
+	r->refs++;
     }
-    return ret;
+    return self;
+}
+
+/**
+ * call-seq:
+ *     URegexp::Replacement.new(str)
+ *
+ * Parses replacement text (see URegexp) once, to be used by UString#sub,
+ * UString#gsub for many matches and strings.
+ * */
+VALUE
+icu_repl_initialize(self, repl_text)
+     VALUE           self,
+                     repl_text;
+{
+    Check_Class(repl_text, rb_cUString);
+    return icu_repl_parse(self, rb_obj_freeze(icu_ustr_new(ICU_PTR(repl_text), ICU_LEN(repl_text))));
 }
 
+/* template for one gsub call, +repl_text+ is not copied */
 VALUE
-icu_reg_get_prematch(pat, prev_end)
-     VALUE           pat;
-     long            prev_end;
+icu_repl_new(repl_text)
+     VALUE           repl_text;
 {
-    URegularExpression *the_expr = UREGEX(pat)->pattern;
-    UErrorCode      error = U_ZERO_ERROR;
-    int32_t         len = 0;
-    int32_t         cur_start = uregex_start(the_expr, 0, &error);
-    const UChar    *temp = uregex_getText(the_expr, &len, &error);
-    VALUE           pm =
-	icu_ustr_new(temp + prev_end, cur_start - prev_end);
-    return pm;
+    return icu_repl_parse(icu_repl_s_alloc(rb_cUReplacement), repl_text);
 }
 
+/**
+ * call-seq:
+ *     replacement.to_u => UString
+ *
+ * Returns replacement text.
+ * */
 VALUE
-icu_reg_get_tail(pat, prev_end)
-     VALUE           pat;
-     long            prev_end;
+icu_repl_to_u(self)
+     VALUE           self;
+{
+    return UREPL(self)->source;
+}
+
+/**
+ * Appends replacement for current match of matcher +pat+ to +buf+.
+ * Groups, which are not matched or are not in pattern, are replaced with nothing.
+ */
+void
+icu_repl_append(repl, pat, buf)
+     VALUE           repl,
+                     pat,
+                     buf;
 {
+    ICUReplacement *r = UREPL(repl);
+    URegularExpression *the_expr = UREGEX(pat)->pattern;
     UErrorCode      error = U_ZERO_ERROR;
+    int32_t         len, g_start, g_end;
+    const UChar    *text = uregex_getText(the_expr, &len, &error);
+    ICUReplSegment *seg;
+    long            i;
+    for (i = 0; i < r->count; i++) {
+	seg = r->seg + i;
+	if (seg->group == -1) {
+	    ustr_append_units(USTRING(buf), r->text + seg->start, seg->len);
+	    continue;
+	}
+	error = U_ZERO_ERROR;
+	g_start = uregex_start(the_expr, seg->group, &error);
+	g_end   = uregex_end  (the_expr, seg->group, &error);
+	if(U_SUCCESS(error) && g_start != -1  ) {
+	   ustr_append_units(USTRING(buf), text + g_start, g_end - g_start);
+	}
+    }
+}
+
+/**
+ * Replaces matches of matcher +pat+, which has found first match in +str+, 
+ * by +repl+ template. All matches are found before +str+ is changed. If each
+ * piece of output ends before end of its match, and no referenced group lies
+ * under output written before it, +str+ is edited in place, else it gets new buffer.
+ */
+void
+icu_repl_apply(repl, pat, str, once)
+     VALUE           repl,
+                     pat,
+                     str;
+     int             once;
+{
+    ICUReplacement *r = UREPL(repl);
     URegularExpression *the_expr = UREGEX(pat)->pattern;
-    int32_t         len = 0;
-    const UChar    *temp = uregex_getText(the_expr, &len, &error);
-    VALUE           pm = icu_ustr_new(temp + prev_end, len - prev_end);
-    return pm;
+    ICUString      *s = USTRING(str);
+    UErrorCode      error = U_ZERO_ERROR;
+    long            width = 2 + 2 * r->refs;	/* offsets per match: match, then referenced groups */
+    long            n = 0, capa = 16, i, j, k;
+    long            out = 0, prev_end = 0, max_len = 0, len, total;
+    int32_t        *rec = ALLOC_N(int32_t, capa * width), *m;
+    UChar          *dest, *scratch = 0, *t;
+    int             fits = 1;
+
+    do {
+	if (n == capa) {
+	    capa *= 2;
+	    REALLOC_N(rec, int32_t, capa * width);
+	}
+	m = rec + n * width;
+	error = U_ZERO_ERROR;
+	m[0] = uregex_start(the_expr, 0, &error);
+	m[1] = uregex_end(the_expr, 0, &error);
+	len = r->text_len;
+	out += m[0] - prev_end;
+	for (i = 0, k = 2; i < r->count; i++) {
+	    if (r->seg[i].group == -1)
+		continue;
+	    error = U_ZERO_ERROR;
+	    m[k] = uregex_start(the_expr, r->seg[i].group, &error);
+	    m[k + 1] = uregex_end(the_expr, r->seg[i].group, &error);
+	    if (U_FAILURE(error) || m[k] == -1)
+		m[k] = m[k + 1] = 0;
+	    /* group in lookbehind may lie under output written already */
+	    if (m[k] < m[k + 1] && m[k] < out)
+		fits = 0;
+	    len += m[k + 1] - m[k];
+	    k += 2;
+	}
+	out += len;
+	if (out > m[1])
+	    fits = 0;
+	if (len > max_len)
+	    max_len = len;
+	prev_end = m[1];
+	n++;
+	error = U_ZERO_ERROR;
+    } while (!once && uregex_findNext(the_expr, &error));
+
+    total = out + s->len - prev_end;
+    if (fits) {
+	dest = s->ptr;
+	/* groups may lie under output of own match */
+	if (r->refs)
+	    scratch = ALLOC_N(UChar, max_len + 1);
+    } else {
+	dest = ALLOC_N(UChar, total + 1);
+    }
+    out = prev_end = 0;
+    for (j = 0; j < n; j++) {
+	m = rec + j * width;
+	u_memmove(dest + out, s->ptr + prev_end, m[0] - prev_end);
+	out += m[0] - prev_end;
+	t = scratch ? scratch : dest + out;
+	len = 0;
+	for (i = 0, k = 2; i < r->count; i++) {
+	    if (r->seg[i].group == -1) {
+		u_memcpy(t + len, r->text + r->seg[i].start, r->seg[i].len);
+		len += r->seg[i].len;
+	    } else {
+		u_memcpy(t + len, s->ptr + m[k], m[k + 1] - m[k]);
+		len += m[k + 1] - m[k];
+		k += 2;
+	    }
+	}
+	if (scratch)
+	    u_memcpy(dest + out, scratch, len);
+	out += len;
+	prev_end = m[1];
+    }
+    u_memmove(dest + out, s->ptr + prev_end, s->len - prev_end);
+    free(rec);
+    if (scratch)
+	free(scratch);
+    if (!fits) {
+	free(s->ptr);
+	s->ptr = dest;
+	s->capa = total + 1;
+    }
+    s->len = total;
+    s->ptr[total] = 0;
+    ustr_capa_resize(s, total + 1);
 }
 
 /**
@@ -554,6 +906,101 @@ icu_reg_from_rb_str(argc, argv, obj)
     return icu_reg_new(ICU_PTR(pat), ICU_LEN(pat), reg_opts);
 }
 
+/* --------- match data: group offsets, UStrings and Ranges are made on access */
+typedef struct {
+    VALUE           subject;	/* frozen text, starting at offset base of matched string */
+    long            base;
+    long            count;	/* number of groups, including group 0 */
+    int32_t        *offsets;	/* start, end of each group; -1 if not matched */
+    VALUE          *groups;	/* materialized groups, Qnil if not yet */
+} ICUMatch;
+
+static void
+icu_umatch_mark(m)
+     ICUMatch       *m;
+{
+    long            i;
+    rb_gc_mark(m->subject);
+    if (m->groups)
+	for (i = 0; i < m->count; i++)
+	    rb_gc_mark(m->groups[i]);
+}
+
+static void
+icu_umatch_free(m)
+     ICUMatch       *m;
+{
+    if (m->groups)
+	free(m->groups);
+    free(m);
+}
+
+static ICUMatch *
+icu_umatch_make(count)
+     long            count;
+{
+    /* offsets are kept in the same block */
+    ICUMatch       *m = (ICUMatch *) xmalloc(sizeof(ICUMatch) + 2 * count * sizeof(int32_t));
+    m->subject = Qnil;
+    m->base = 0;
+    m->count = count;
+    m->offsets = (int32_t *) (m + 1);
+    m->groups = 0;
+    return m;
+}
+
+static VALUE
+icu_umatch_alloc(klass, count)
+     VALUE           klass;
+     long            count;
+{
+    return Data_Wrap_Struct(klass, icu_umatch_mark, icu_umatch_free, icu_umatch_make(count));
+}
+
+VALUE
+icu_umatch_s_alloc(klass)
+     VALUE           klass;
+{
+    return icu_umatch_alloc(klass, 0);
+}
+
+#define UMATCH(obj) ((ICUMatch *)DATA_PTR(obj))
+
+/* copies offsets and subject of +orig+; groups are extracted again on access */
+VALUE
+icu_umatch_init_copy(copy, orig)
+     VALUE           copy,
+                     orig;
+{
+    ICUMatch       *m, *o;
+    if (copy == orig)
+	return copy;
+    if (TYPE(orig) != T_DATA || RDATA(orig)->dfree != (RUBY_DATA_FUNC) icu_umatch_free)
+	rb_raise(rb_eTypeError, "wrong argument type");
+    o = UMATCH(orig);
+    m = icu_umatch_make(o->count);
+    MEMCPY(m->offsets, o->offsets, int32_t, 2 * o->count);
+    m->base = o->base;
+    m->subject = o->subject;
+    icu_umatch_free(UMATCH(copy));
+    DATA_PTR(copy) = m;
+    return copy;
+}
+
+/* converts index to 0...count, or returns -1 */
+static long
+icu_umatch_index(m, index)
+     ICUMatch       *m;
+     VALUE           index;
+{
+    long            idx;
+    Check_Type(index, T_FIXNUM);
+    idx = FIX2LONG(index);
+    if (idx < 0)
+	idx += m->count;
+    return idx < 0 || idx >= m->count ? -1 : idx;
+}
+
 /**
  * call-seq:
  *     umatch[idx] => string
@@ -565,12 +1012,26 @@ icu_umatch_aref(match, index)
      VALUE           match,
                      index;
 {
-    long idx;
-    VALUE cg;
-    Check_Type(index, T_FIXNUM);
-    idx = FIX2LONG(index);
-    cg = rb_iv_get(match, "@cg");
-    return rb_ary_entry(cg, idx);
+    ICUMatch       *m = UMATCH(match);
+    long            idx = icu_umatch_index(m, index), i;
+    int32_t         start;
+    VALUE           obj;
+    if (idx < 0)
+	return Qnil;
+    if (!m->groups) {
+	m->groups = ALLOC_N(VALUE, m->count);
+	for (i = 0; i < m->count; i++)
+	    m->groups[i] = Qnil;
+    }
+    if (NIL_P(m->groups[idx])) {
+	start = m->offsets[2 * idx];
+	/* not matched group is empty */
+	obj = start < 0 ? icu_ustr_new(0, 0) :
+	    icu_ustr_new(ICU_PTR(m->subject) + start - m->base, m->offsets[2 * idx + 1] - start);
+	rb_obj_freeze(obj);
+	m->groups[idx] = obj;
+    }
+    return m->groups[idx];
 }
 
 /**
@@ -588,12 +1049,11 @@ icu_umatch_range(match, index)
      VALUE           match,
                      index;
 {
-    long idx;
-    VALUE cg;
-    Check_Type(index, T_FIXNUM);
-    idx = FIX2LONG(index);
-    cg = rb_iv_get(match, "@ranges");
-    return rb_ary_entry(cg, idx);
+    ICUMatch       *m = UMATCH(match);
+    long            idx = icu_umatch_index(m, index);
+    if (idx < 0 || m->offsets[2 * idx] < 0)
+	return Qnil;
+    return rb_range_new(LONG2NUM(m->offsets[2 * idx]), LONG2NUM(m->offsets[2 * idx + 1] - 1), 0);
 }
 
 
@@ -607,53 +1067,77 @@ VALUE
 icu_umatch_size(match)
      VALUE           match;
 {
-    VALUE           cg = rb_iv_get(match, "@cg");
-    return LONG2NUM(RARRAY(cg)->len - 1);
+    return LONG2NUM(UMATCH(match)->count - 1);
+}
+
+/**
+ * call-seq:
+ *     umatch.to_a => array
+ *
+ * Returns array of all groups, starting with full match.
+ * */
+VALUE
+icu_umatch_to_a(match)
+     VALUE           match;
+{
+    long            i, count = UMATCH(match)->count;
+    VALUE           ret = rb_ary_new2(count);
+    for (i = 0; i < count; i++)
+	rb_ary_push(ret, icu_umatch_aref(match, LONG2FIX(i)));
+    return ret;
 }
 
+VALUE
+icu_umatch_inspect(match)
+     VALUE           match;
+{
+    VALUE           ret = rb_str_new2("#<UMatch ");
+    rb_str_append(ret, rb_inspect(icu_umatch_to_a(match)));
+    rb_str_cat(ret, ">", 1);
+    return ret;
+}
 
+/* +re+ is a matcher with current match in +str+. Match keeps +str+ if it is frozen, 
+ * else a frozen copy of the part, covered by groups, to extract them on access. */
 VALUE
-icu_umatch_init( self, re)
-     VALUE            self, re;
+icu_umatch_new(re, str)
+     VALUE           re,
+                     str;
 {
-    UErrorCode           status = U_ZERO_ERROR;
-    long                 count, i, cu_start, cu_end;
-    URegularExpression * the_regex;
-    VALUE                obj, groups, ranges;
-    
-    Check_Class(re, rb_cURegexp);
-    the_regex = UREGEX(re)->pattern;
-    count = icu_group_count(re); 
-    if (U_FAILURE(status)) {
-	rb_raise(rb_eArgError, u_errorName(status));
+    URegularExpression *the_regex = UREGEX(re)->pattern;
+    UErrorCode      status = U_ZERO_ERROR;
+    long            count = icu_group_count(re) + 1, i;
+    VALUE           match = icu_umatch_alloc(rb_cUMatch, count);
+    ICUMatch       *m = UMATCH(match);
+    long            beg, end;
+    for (i = 0; i < count; i++) {
+	m->offsets[2 * i] = uregex_start(the_regex, i, &status);
+	m->offsets[2 * i + 1] = uregex_end(the_regex, i, &status);
     }
-    groups = rb_ary_new2(count);
-    rb_iv_set(self, "@cg", groups);
-    for (i = 0; i <= count; i++) {
-	obj = icu_reg_nth_match(re, i);
-	rb_obj_freeze(obj);
-	rb_ary_store(groups, i, obj);
+    if (U_FAILURE(status))
+	rb_raise(rb_eArgError, u_errorName(status));
+    if (OBJ_FROZEN(str)) {
+	m->subject = str;
+	return match;
     }
-
-    ranges = rb_ary_new2(count);
-    for ( i = 0; i <= count; i++){
-        cu_start = uregex_start(the_regex, i, &status);
-        cu_end  = uregex_end(the_regex, i, &status);
-	if( cu_start == -1) rb_ary_store(ranges, i, Qnil);
-	else rb_ary_store(ranges, i, rb_range_new(LONG2NUM(cu_start), LONG2NUM(cu_end-1), 0));
+    /* groups in lookaround may lie outside of group 0 */
+    beg = m->offsets[0];
+    end = m->offsets[1];
+    for (i = 1; i < count; i++) {
+	if (m->offsets[2 * i] < 0)
+	    continue;
+	if (m->offsets[2 * i] < beg)
+	    beg = m->offsets[2 * i];
+	if (m->offsets[2 * i + 1] > end)
+	    end = m->offsets[2 * i + 1];
     }
-    rb_iv_set(self, "@ranges", ranges);
-    return self;
-}
-VALUE icu_umatch_new(re) 
-	VALUE 		re;
-{
-	return icu_umatch_init(rb_class_new_instance(0, NULL, rb_cUMatch), re);
+    m->base = beg;
+    m->subject = rb_obj_freeze(icu_ustr_new(ICU_PTR(str) + beg, end - beg));
+    return match;
 }
 
 
 
-
 void initialize_uregexp (void) 
 {
 /* regular expressions */
@@ -678,6 +1162,20 @@ void initialize_uregexp (void)
 
     rb_define_global_function("ure", icu_reg_from_rb_str, -1);
 
+/**
+ * Document-class: URegexp::Replacement
+ *
+ * Parsed replacement text for UString#sub, UString#gsub. Passing it
+ * instead of UString saves parsing of $n and escapes on each call.
+ *
+ *     r = URegexp::Replacement.new("$2 $1".u)
+ *     names.each { |s| s.gsub!(ure("(\\w+) (\\w+)"), r) }
+ */
+    rb_cUReplacement = rb_define_class_under(rb_cURegexp, "Replacement", rb_cObject);
+    rb_define_alloc_func(rb_cUReplacement, icu_repl_s_alloc);
+    rb_define_method(rb_cUReplacement, "initialize", icu_repl_initialize, 1);
+    rb_define_method(rb_cUReplacement, "to_u", icu_repl_to_u, 0);
+
 /**
  * Document-class: UMatch 
  *
@@ -686,9 +1184,13 @@ void initialize_uregexp (void)
  * passed block. 
  */
     rb_cUMatch = rb_define_class("UMatch", rb_cObject);
+    rb_define_alloc_func(rb_cUMatch, icu_umatch_s_alloc);
+    rb_define_method(rb_cUMatch, "initialize_copy", icu_umatch_init_copy, 1);
     rb_define_method(rb_cUMatch, "[]", icu_umatch_aref, 1);
     rb_define_method(rb_cUMatch, "size", icu_umatch_size, 0);
     rb_define_method(rb_cUMatch, "range", icu_umatch_range, 1);
+    rb_define_method(rb_cUMatch, "to_a", icu_umatch_to_a, 0);
+    rb_define_method(rb_cUMatch, "inspect", icu_umatch_inspect, 0);
 
     rb_define_method(rb_cRegexp, "to_u", icu_reg_from_rb_reg, 0);
     rb_define_alias (rb_cRegexp, "U", "to_u");
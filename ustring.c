@@ -19,15 +19,29 @@
 VALUE           icu_ustr_replace(VALUE str, VALUE str2);
 VALUE		ustr_gsub(int argc, VALUE * argv, VALUE str, int bang, int once);
 extern VALUE icu_from_rstr(int argc, VALUE * argv, VALUE str);
+extern int icu_parallel_p(long bytes);
+extern VALUE icu_utf8_encode_parallel(const UChar * src, long src_len);
+extern int icu_cnv_policy(VALUE sym);
+extern void icu_cnv_set_policy(UConverter * cnv, ICUCnvErrors * e, UErrorCode * status);
+extern void icu_cnv_clear_policy(UConverter * cnv);
+extern char * icu_cnv_from_uchars(UConverter * cnv, ICUCnvErrors * e, const UChar * src, long src_len, long * len, UErrorCode * status);
+extern UConverter * icu_cnv_checkout(const char * name, UErrorCode * status);
+extern void icu_cnv_checkin(const char * name, UConverter * cnv);
+extern void icu_col_attrs_init(UColAttributeValue * attrs);
+extern UCollator * icu_col_checkout(const char * locale, const UColAttributeValue * attrs, UErrorCode * status);
+extern void icu_col_checkin(const char * locale, const UColAttributeValue * attrs, UCollator * col);
 
  VALUE rb_cURegexp;
  VALUE rb_cUString;
  VALUE rb_cUMatch;
+ VALUE rb_cUReplacement;
  VALUE rb_cUResourceBundle;
  VALUE rb_cULocale;
  VALUE rb_cUCalendar;
  VALUE rb_cUConverter;
  VALUE rb_cUCollator;
+ VALUE rb_cUCollatorIndex;
+ VALUE rb_cUReader;
  
 #include "uregex.h"
 
@@ -128,6 +142,17 @@ void ustr_splice_units(ICUString * str, long start, long del_len, const UChar *
      free(temp);
    }
 }
+/* appends units, growing buffer geometrically; for strings being built */
+void ustr_append_units(ICUString * str, const UChar * p, long n)
+{
+   if( n <= 0) return;
+   if( str->len + n + 1 > str->capa ) {
+       ustr_capa_resize(str, str->len + n + 1 > str->capa * 2 ? str->len + n + 1 : str->capa * 2);
+   }
+   u_memcpy(str->ptr + str->len, p, n);
+   str->len += n;
+   str->ptr[str->len] = 0;
+}
 static inline void
 ustr_mod_check(VALUE s, UChar *p, long len)
 {
@@ -755,7 +780,9 @@ icu_ustr_index_m(argc, argv, str)
     	processed = 1;
     }
     if( CLASS_OF(sub) == rb_cURegexp) {
-       	pos = icu_reg_search(sub, str, pos, 0);
+	VALUE matcher = icu_reg_matcher(sub);
+       	pos = icu_reg_search(matcher, str, pos, 0);
+	icu_reg_release(sub, matcher);
     	processed = 1;
     }
     if(! processed ) {
@@ -841,7 +868,9 @@ icu_ustr_rindex_m(argc, argv, str)
 	    break;
 	}
 	if (CLASS_OF(sub) == rb_cURegexp) {
-	    pos = icu_reg_search(sub, str, pos, 1);
+	    VALUE matcher = icu_reg_matcher(sub);
+	    pos = icu_reg_search(matcher, str, pos, 1);
+	    icu_reg_release(sub, matcher);
 	    if (pos >= 0)
 		return LONG2NUM(pos);
 	    break;
@@ -1251,10 +1280,16 @@ icu_ustr_to_ustr(argc, argv, str)
 
 /**
  * call-seq:
- *    str.to_s(encoding = 'utf8') => String
+ *    str.to_s(encoding = 'utf8', options = {}) => String
  *
  * Converts to Ruby String (byte-oriented) value in  given encoding.
  * When no encoding is given, assumes UTF-8.
+ * Large strings are converted to UTF-8 in several threads, see UString.parallel_threshold.
+ *
+ * Option <tt>:on_error</tt> selects handling of unmappable characters without raising
+ * exception, see UConverter#on_error=.
+ *
+ *      "café".u.to_s("US-ASCII", :on_error => :escape)  # => "caf\\u00E9"
  */
 VALUE
 icu_ustr_to_rstr(argc, argv, str)
@@ -1262,61 +1297,199 @@ icu_ustr_to_rstr(argc, argv, str)
      VALUE          *argv,
                      str;
 {
-    VALUE           enc;
+    VALUE           enc, options, policy;
     char           *encoding = 0;	/* default */
     UErrorCode      error = 0;
     UConverter     *conv ;
     int enclen, needed = 0;
+    long len;
     char * buf;
     VALUE s;
-    if (rb_scan_args(argc, argv, "01", &enc) == 1) {
+    ICUCnvErrors errors, *e = NULL;
+    rb_scan_args(argc, argv, "02", &enc, &options);
+    if (TYPE(enc) == T_HASH && NIL_P(options)) {
+	options = enc;
+	enc = Qnil;
+    }
+    if (!NIL_P(enc)) {
 	Check_Type(enc, T_STRING);
 	encoding = RSTRING(enc)->ptr;
     }
-    
-    enclen = ICU_LEN(str) + 1;
-    buf = ALLOC_N(char, enclen);
-   
-    if( !encoding || !strncmp(encoding, "utf8", 4)){
-	  u_strToUTF8( buf, enclen, &needed, ICU_PTR(str), ICU_LEN(str), &error);
-          if (U_BUFFER_OVERFLOW_ERROR == error) {
-        	REALLOC_N(buf, char, needed + 1);
-        	error = 0;
-        	u_strToUTF8( buf, needed, &needed, ICU_PTR(str), ICU_LEN(str), &error);
-         }
-	 if( U_FAILURE(error) ){
-	       free(buf);
-	       rb_raise(rb_eArgError, u_errorName(error));
-	 }
-         s = rb_str_new(buf, needed);
-
-    } else {
-            conv = ucnv_open(encoding, &error);
-            if (U_FAILURE(error)) {
-        	ucnv_close(conv);
-		free(buf);
-        	rb_raise(rb_eArgError, u_errorName(error));
-            }
-            enclen =
-        	ucnv_fromUChars(conv, buf, enclen, ICU_PTR(str), ICU_LEN(str),
-        			&error);
-            if (U_BUFFER_OVERFLOW_ERROR == error) {
-        	REALLOC_N(buf, char, enclen + 1);
-        	error = 0;
-        	ucnv_fromUChars(conv, buf, enclen, ICU_PTR(str), ICU_LEN(str),
-        			&error);
-            }
-	    if( U_FAILURE(error) ){
-	       free(buf);
-	       rb_raise(rb_eArgError, u_errorName(error));
-	    }
-            s = rb_str_new(buf, enclen);
-	    ucnv_close(conv);
+    if (!NIL_P(options)) {
+	Check_Type(options, T_HASH);
+	policy = rb_hash_aref(options, ID2SYM(rb_intern("on_error")));
+	if (!NIL_P(policy)) {
+	    errors.policy = icu_cnv_policy(policy);
+	    e = &errors;
+	}
     }
+    if( !e && (!encoding || !strncmp(encoding, "utf8", 4)) ) {
+	if( icu_parallel_p(ICU_LEN(str) * sizeof(UChar)) ) {
+	    s = icu_utf8_encode_parallel(ICU_PTR(str), ICU_LEN(str));
+	    /* on invalid input fall through to report error */
+	    if( s != Qnil ) return s;
+	}
+	enclen = ICU_LEN(str) + 1;
+	buf = ALLOC_N(char, enclen);
+	u_strToUTF8( buf, enclen, &needed, ICU_PTR(str), ICU_LEN(str), &error);
+	if (U_BUFFER_OVERFLOW_ERROR == error) {
+	    REALLOC_N(buf, char, needed + 1);
+	    error = 0;
+	    u_strToUTF8( buf, needed, &needed, ICU_PTR(str), ICU_LEN(str), &error);
+	}
+	if( U_FAILURE(error) ){
+	    free(buf);
+	    rb_raise(rb_eArgError, u_errorName(error));
+	}
+	s = rb_str_new(buf, needed);
+	free(buf);
+	return s;
+    }
+    if( !encoding || !strncmp(encoding, "utf8", 4) ) encoding = "UTF-8";
+    conv = icu_cnv_checkout(encoding, &error);
+    if (U_FAILURE(error)) {
+	rb_raise(rb_eArgError, u_errorName(error));
+    }
+    if( e ) icu_cnv_set_policy(conv, e, &error);
+    buf = icu_cnv_from_uchars(conv, e, ICU_PTR(str), ICU_LEN(str), &len, &error);
+    if( e ) icu_cnv_clear_policy(conv);
+    icu_cnv_checkin(encoding, conv);
+    if( U_FAILURE(error) ){
+	free(buf);
+	rb_raise(rb_eArgError, u_errorName(error));
+    }
+    s = rb_str_new(buf, len);
     free(buf);
     return s;
 }
 
+#define ENCODE_CHUNK_SIZE 65536
+typedef struct {
+    VALUE           str;
+    VALUE           io;		/* Qnil to yield chunks */
+    const char     *encoding;
+    UConverter     *conv;
+    char           *buf;
+    long            size;
+    long            total;
+} ICUEncodeStream;
+
+static VALUE
+icu_ustr_encode_stream(s)
+     ICUEncodeStream *s;
+{
+    UErrorCode      status;
+    const UChar    *src = ICU_PTR(s->str),
+                   *src_end = src + ICU_LEN(s->str);
+    char           *target;
+    VALUE           chunk;
+    do {
+	status = U_ZERO_ERROR;
+	target = s->buf;
+	ucnv_fromUnicode(s->conv, &target, s->buf + s->size, &src, src_end, NULL, TRUE, &status);
+	if (U_FAILURE(status) && status != U_BUFFER_OVERFLOW_ERROR)
+	    rb_raise(rb_eArgError, u_errorName(status));
+	if (target > s->buf) {
+	    chunk = rb_str_new(s->buf, target - s->buf);
+	    s->total += target - s->buf;
+	    if (NIL_P(s->io))
+		rb_yield(chunk);
+	    else
+		rb_io_write(s->io, chunk);
+	}
+    } while (status == U_BUFFER_OVERFLOW_ERROR);
+    return LONG2NUM(s->total);
+}
+
+static VALUE
+icu_ustr_encode_stream_ensure(s)
+     ICUEncodeStream *s;
+{
+    --(USTRING(s->str)->busy);
+    icu_cnv_checkin(s->encoding, s->conv);
+    free(s->buf);
+    return Qnil;
+}
+
+static VALUE
+icu_ustr_encode_to(str, io, enc, size)
+     VALUE           str,
+                     io,
+                     enc;
+     long            size;
+{
+    ICUEncodeStream s;
+    UErrorCode      status = U_ZERO_ERROR;
+    s.encoding = "utf8";
+    if (!NIL_P(enc)) {
+	Check_Type(enc, T_STRING);
+	s.encoding = RSTRING(enc)->ptr;
+    }
+    if (size <= 0)
+	rb_raise(rb_eArgError, "chunk size must be positive, got %ld", size);
+    s.buf = ALLOC_N(char, size);
+    s.conv = icu_cnv_checkout(s.encoding, &status);
+    if (U_FAILURE(status)) {
+	free(s.buf);
+	rb_raise(rb_eArgError, u_errorName(status));
+    }
+    s.str = str;
+    s.io = io;
+    s.size = size;
+    s.total = 0;
+    ++(USTRING(str)->busy);
+    return rb_ensure(icu_ustr_encode_stream, (VALUE) &s, icu_ustr_encode_stream_ensure, (VALUE) &s);
+}
+
+/**
+ * call-seq:
+ *    str.write_to(io, encoding = 'utf8') => integer
+ *
+ * Writes string to +io+ in given encoding, without creating full encoded
+ * copy: text is encoded in fixed-size chunks, and each chunk is passed to 
+ * <code>io.write</code>. Returns number of bytes written.
+ *
+ *     File.open("out.txt", "w") { |f| "Привет".u.write_to(f, "cp1251") }  # => 6
+ */
+VALUE
+icu_ustr_write_to(argc, argv, str)
+     int             argc;
+     VALUE          *argv,
+                     str;
+{
+    VALUE           io, enc;
+    rb_scan_args(argc, argv, "11", &io, &enc);
+    return icu_ustr_encode_to(str, io, enc, ENCODE_CHUNK_SIZE);
+}
+
+/**
+ * call-seq:
+ *    str.each_encoded_chunk(encoding = 'utf8', size = 65536) {|chunk| block } => str
+ *
+ * Encodes string in given encoding, yielding Strings of at most +size+ bytes.
+ * String can't be modified inside block.
+ *
+ *     "abcdef".u.each_encoded_chunk("utf8", 4) { |c| sock.write(c) }
+ */
+VALUE
+icu_ustr_each_encoded_chunk(argc, argv, str)
+     int             argc;
+     VALUE          *argv,
+                     str;
+{
+    VALUE           enc, size;
+    long            chunk_size = ENCODE_CHUNK_SIZE;
+#ifdef RETURN_ENUMERATOR
+    RETURN_ENUMERATOR(str, argc, argv);
+#endif
+    if (rb_scan_args(argc, argv, "02", &enc, &size) == 2) {
+	Check_Type(size, T_FIXNUM);
+	chunk_size = FIX2LONG(size);
+    }
+    icu_ustr_encode_to(str, Qnil, enc, chunk_size);
+    return str;
+}
+
 /* -------------- */
 extern VALUE    icu_format(UChar * pattern, int32_t len, VALUE args,
 			   int32_t arg_len, char *locale);
@@ -1358,7 +1531,7 @@ icu_ustr_format(str, args)
  *  Otherwise returns +nil+
  *     
  *     "cat o' 9 tails".u =~ '\d'    #=> nil
- *     "cat o' 9 tails".u =~ /\d/.U  #=> #<UMatch:0xf6fb7d5c @cg=[<U000039>]>
+ *     "cat o' 9 tails".u =~ /\d/.U  #=> #<UMatch [\u0039]>
  *     "cat o' 9 tails".u =~ 9       #=> false
  *     "cat o' 9 tails".u =~ '9'.u   #=> 7
  */
@@ -1425,13 +1598,14 @@ ustr_scan_once(str, pat, start)
                      pat;
      long           *start;
 {
-    VALUE           result;
+    VALUE           result = Qnil, matcher;
     long            i;
     long            beg,
                     end, num_regs;
 
-    if (icu_reg_search(pat, str, *start, 0) >= 0) {
-	icu_reg_range(pat, 0, &beg, &end);
+    matcher = icu_reg_matcher(pat);
+    if (icu_reg_search(matcher, str, *start, 0) >= 0) {
+	icu_reg_range(matcher, 0, &beg, &end);
 	if (beg == end) {
 	    *start = end + 1;
 	} else {
@@ -1439,16 +1613,16 @@ ustr_scan_once(str, pat, start)
 	}
 	num_regs = icu_group_count(pat);
 	if (num_regs <= 1) {
-	    return icu_reg_nth_match(pat, 0);
-	}
-	result = rb_ary_new2(num_regs);
-	for (i = 1; i <= num_regs; i++) {
-	    rb_ary_store(result, i - 1, icu_reg_nth_match(pat, i));
+	    result = icu_reg_nth_match(matcher, 0);
+	} else {
+	    result = rb_ary_new2(num_regs);
+	    for (i = 1; i <= num_regs; i++) {
+		rb_ary_store(result, i - 1, icu_reg_nth_match(matcher, i));
+	    }
 	}
-
-	return result;
     }
-    return Qnil;
+    icu_reg_release(pat, matcher);
+    return result;
 }
 
 
@@ -1730,6 +1904,34 @@ icu_ustr_points(str)
     return buf;
 }
 
+/**
+ * call-seq:
+ *     str.codepoints_packed => String
+ *
+ * Returns codepoints as binary String of native-endian 32-bit unsigned integers,
+ * same as <code>str.codepoints.pack("L*")</code>, without intermediate array.
+ */
+VALUE
+icu_ustr_points_packed(str)
+     VALUE           str;
+{
+    VALUE           buf;
+    uint32_t       *out;
+    int32_t         i,
+                    n,
+                    c;
+    UChar          *s = ICU_PTR(str);
+    n = ICU_LEN(str);
+    buf = rb_str_new(0, u_countChar32(s, n) * sizeof(uint32_t));
+    out = (uint32_t *) RSTRING(buf)->ptr;
+    i = 0;
+    while (i < n) {
+	U16_NEXT(s, i, n, c); /* care surrogates */
+	*out++ = c;
+    }
+    return buf;
+}
+
 
 /**
  * call-seq:
@@ -1768,10 +1970,13 @@ icu_ustr_subpat(str, re, nth)
                      re;
      int             nth;
 {
-    if (icu_reg_search(re, str, 0, 0) >= 0) {
-	return icu_reg_nth_match(re, nth);
+    VALUE           matcher = icu_reg_matcher(re),
+                    ret = Qnil;
+    if (icu_reg_search(matcher, str, 0, 0) >= 0) {
+	ret = icu_reg_nth_match(matcher, nth);
     }
-    return Qnil;
+    icu_reg_release(re, matcher);
+    return ret;
 }
 
 /* beg len are code unit indexes*/
@@ -1954,6 +2159,7 @@ icu_ustr_sub_bang(argc, argv, str)
  *  <code>'\d'</code> will match a backslash followed by a 'd').
  *     
  *  The sequences <code>$1</code>,  <code>$2</code>, etc., may be used.
+ *  <i>replacement</i> may also be a <code>URegexp::Replacement</code>, parsed once.
  *     
  *  In the block form, the current UMatch object is passed in as a parameter.
  *  The value returned by the block will be substituted for the match on each call.
@@ -2082,12 +2288,13 @@ icu_ustr_subpat_set(str, re, nth, val)
     long            start,
                     end,
                     len;
-    VALUE matched;
+    VALUE matched, matcher = icu_reg_matcher(re);
 
-    if (icu_reg_search(re, str, 0, 0) < 0) {
+    if (icu_reg_search(matcher, str, 0, 0) < 0) {
 	rb_raise(rb_eIndexError, "regexp not matched");
     }
-    matched = icu_reg_range(re, nth, &start, &end);
+    matched = icu_reg_range(matcher, nth, &start, &end);
+    icu_reg_release(re, matcher);
     if (NIL_P(matched)) {
 	rb_raise(rb_eIndexError, "regexp group %d not matched", nth);
     }
@@ -2250,6 +2457,25 @@ icu_ustr_slice_bang(argc, argv, str)
     return result;
 }
 
+/* gives buffer of +buf+ to +str+, without copying */
+static void
+ustr_take_buffer(str, buf)
+     VALUE           str,
+                     buf;
+{
+    UChar          *ptr = ICU_PTR(str);
+    long            capa = ICU_CAPA(str);
+    icu_check_frozen(1, str);
+    ICU_PTR(str) = ICU_PTR(buf);
+    ICU_LEN(str) = ICU_LEN(buf);
+    ICU_CAPA(str) = ICU_CAPA(buf);
+    ICU_PTR(buf) = ptr;
+    ICU_CAPA(buf) = capa;
+    ICU_LEN(buf) = 0;
+    ptr[0] = 0;
+    OBJ_INFECT(str, buf);
+}
+
 VALUE
 ustr_gsub(argc, argv, str, bang, once)
      int             argc;
@@ -2263,45 +2489,52 @@ ustr_gsub(argc, argv, str, bang, once)
     long            beg,
                     end,
                     prev_end;
-    int             tainted = 0,
-	iter = 0;
-    VALUE buf, curr_repl, umatch, block_res;
+    int             iter = 0;
+    VALUE buf, curr_repl, umatch, block_res, matcher;
     if (argc == 1 && rb_block_given_p()) {
 	iter = 1;
     } else if (argc == 2) {
 	repl = argv[1];
-	Check_Class(repl, rb_cUString);
-	if (OBJ_TAINTED(repl))
-	    tainted = 1;
+	if (CLASS_OF(repl) != rb_cUReplacement)
+	    Check_Class(repl, rb_cUString);
     } else {
 	rb_raise(rb_eArgError, "wrong number of arguments (%d for 2)",
 		 argc);
     }
 
     pat = get_pat(argv[0], 1);
-    beg = icu_reg_search(pat, str, 0, 0);
+    matcher = icu_reg_matcher(pat);
+    beg = icu_reg_search(matcher, str, 0, 0);
 
     if (beg < 0) {
 	/* no match */
+	icu_reg_release(pat, matcher);
 	if (bang)
 	    return Qnil;
 	return icu_ustr_dup(str);
     }
+    if(rb_block_given_p()) iter = 1;
+    if (!iter && CLASS_OF(repl) == rb_cUString)
+	repl = icu_repl_new(repl);
+    if (bang && !iter) {
+	icu_check_frozen(1, str);
+	icu_repl_apply(repl, matcher, str, once);
+	icu_reg_release(pat, matcher);
+	return str;
+    }
     end = 0;
-//    icu_check_frozen(1, str);
     ++(USTRING(str)->busy);
+    /* pieces of str and replacements go to single buffer */
     buf = icu_ustr_new(0, 0);
-    pat = icu_reg_clone(pat);
-    if(rb_block_given_p()) iter = 1;
+    ustr_capa_resize(USTRING(buf), ICU_LEN(str) + 1);
     do {
-
 	prev_end = end;
-	icu_reg_range(pat, 0, &beg, &end);
-	icu_ustr_concat(buf, icu_reg_get_prematch(pat, prev_end));
+	icu_reg_range(matcher, 0, &beg, &end);
+	ustr_append_units(USTRING(buf), ICU_PTR(str) + prev_end, beg - prev_end);
 	if ( iter ) {
 	    UChar * ptr = ICU_PTR(str);
 	    long o_len  = ICU_LEN(str);
-	    umatch = icu_umatch_new(pat);
+	    umatch = icu_umatch_new(matcher, str);
 	    block_res = rb_yield(umatch);
 	    if (CLASS_OF(block_res) == rb_cUString)
 		curr_repl = block_res;
@@ -2311,16 +2544,18 @@ ustr_gsub(argc, argv, str, bang, once)
 		curr_repl =
 		    icu_from_rstr(0, NULL, rb_obj_as_string(block_res));
 	    ustr_mod_check(str, ptr, o_len);
+	    ustr_append_units(USTRING(buf), ICU_PTR(curr_repl), ICU_LEN(curr_repl));
+	    OBJ_INFECT(buf, curr_repl);
 	} else {
-	    curr_repl = icu_reg_get_replacement(pat, repl, prev_end);
+	    icu_repl_append(repl, matcher, buf);
 	}
-	icu_ustr_concat(buf, curr_repl);
     }
-    while (icu_reg_find_next(pat) && !once);
-    icu_ustr_concat(buf, icu_reg_get_tail(pat, end));
+    while (icu_reg_find_next(matcher) && !once);
+    ustr_append_units(USTRING(buf), ICU_PTR(str) + end, ICU_LEN(str) - end);
+    icu_reg_release(pat, matcher);
     --(USTRING(str)->busy);
     if (bang) {
-	icu_ustr_replace(str, buf);
+	ustr_take_buffer(str, buf);
 	return str;
     } else {
 	return buf;
@@ -2360,7 +2595,8 @@ icu_ustr_gsub_bang(argc, argv, str)
  *  <code>'\d'</code> will match a backslash followed by a 'd').
  *     
  *  If a string is used as the replacement,  the sequences <code>$1</code>, <code>$2</code>, and so on
- *  may be used to interpolate successive groups in the match.
+ *  may be used to interpolate successive groups in the match. To avoid parsing
+ *  of replacement on each call, pass <code>URegexp::Replacement</code> instead.
  *     
  *  In the block form, the current UMatch object is passed in as a parameter. The value
  *  returned by the block will be substituted for the match on each call.
@@ -2444,6 +2680,8 @@ icu_ustr_parse_double( int argc, VALUE * argv, VALUE str)
  * Strength must be a fixnum that set collation strength:
  * -1 is default, 0 - primary, 1 - secondary, 2 - ternary.
  * E.g., pass 0 to ignore case and accents, 1 - to ignore case only.
+ *
+ * Collators are cached by locale and strength, so repeated calls don't reopen them.
  **/
 VALUE
 icu_ustr_coll(argc, argv, self) 
@@ -2457,9 +2695,10 @@ icu_ustr_coll(argc, argv, self)
 	VALUE ret = Qnil;
 	VALUE str1, str2, loc, strength = Qnil;
 	char * locale = NULL;
+	UColAttributeValue attrs[UCOL_ATTRIBUTE_COUNT];
 	int n ;
 	n = rb_scan_args(argc, argv, "22", &str1, &str2, &loc, &strength);
-	if ( n == 3) {
+	if ( n >= 3) {
 	   if( loc != Qnil) {
 		   Check_Type(loc, T_STRING);
 	   	   locale = RSTRING(loc)->ptr;
@@ -2467,15 +2706,16 @@ icu_ustr_coll(argc, argv, self)
 	}
 	Check_Class(str1, rb_cUString);
 	Check_Class(str2, rb_cUString);
-	collator = ucol_open(locale, &status);
+	icu_col_attrs_init(attrs);
+	if( n == 4 ){
+	 Check_Type(strength, T_FIXNUM);
+	 attrs[UCOL_STRENGTH] = NUM2INT(strength);
+	}
+	collator = icu_col_checkout(locale, attrs, &status);
 	if( U_FAILURE(status) )
 	{
 	  rb_raise(rb_eArgError, u_errorName(status));
 	}
-	if( n == 4 ){
-	 Check_Type(strength, T_FIXNUM);
-	 ucol_setStrength(collator, NUM2INT(strength));
-	}
 	result = ucol_strcoll(collator, ICU_PTR(str1), ICU_LEN(str1), ICU_PTR(str2), ICU_LEN(str2));
 	
 	switch(result){
@@ -2483,7 +2723,7 @@ icu_ustr_coll(argc, argv, self)
 	  case UCOL_GREATER: ret = INT2FIX(1);break;
 	  case UCOL_LESS:    ret = INT2FIX(-1);break;
 	}
-	ucol_close(collator);
+	icu_col_checkin(locale, attrs, collator);
 	return ret;
 }
 
@@ -2596,6 +2836,7 @@ VALUE icu_ustr_search(argc, argv, str)
 	int32_t start,  len;
 	VALUE ret = rb_ary_new();
 	UCollator * collator = 0;
+	UColAttributeValue attrs[UCOL_ATTRIBUTE_COUNT];
 	UBreakIterator * brkit = 0;
 	char  * loc = 0;
         if ( rb_scan_args(argc, argv, "11", &pat, &options) == 2 ) {
@@ -2623,21 +2864,21 @@ VALUE icu_ustr_search(argc, argv, str)
   	 if (limit!=Qnil)
 	    rb_raise(rb_eArgError, "Limit must be Fixnum, got %s", rb_class2name(CLASS_OF(limit)));
 	    
-	collator = ucol_open(loc, &status);
-	ucol_setStrength(collator, -1);
-	
-	if( options != Qnil && Qtrue == rb_hash_aref( options, ID2SYM(rb_intern("whole_words"))) ) 
-	  brkit = ubrk_open(UBRK_WORD, loc, ICU_PTR(str), ICU_LEN(str),  &status);
-	  
+	icu_col_attrs_init(attrs);
 	if( options != Qnil && Qtrue == rb_hash_aref( options, ID2SYM(rb_intern("ignore_case"))) )
-	   ucol_setStrength(collator, UCOL_SECONDARY);
+	   attrs[UCOL_STRENGTH] = UCOL_SECONDARY;
 	   
 	if( options != Qnil && 
 		( Qtrue == rb_hash_aref( options, ID2SYM(rb_intern("ignore_case_accents")) ) 
 		  || Qtrue == rb_hash_aref( options, ID2SYM(rb_intern("loosely")) ) 
 		) 
 	   )
-	   ucol_setStrength(collator, UCOL_PRIMARY );
+	   attrs[UCOL_STRENGTH] = UCOL_PRIMARY;
+	collator = icu_col_checkout(loc, attrs, &status);
+	if( U_FAILURE(status) ) rb_raise(rb_eArgError, u_errorName(status));
+	
+	if( options != Qnil && Qtrue == rb_hash_aref( options, ID2SYM(rb_intern("whole_words"))) ) 
+	  brkit = ubrk_open(UBRK_WORD, loc, ICU_PTR(str), ICU_LEN(str),  &status);
 	   
 
 	search   = usearch_openFromCollator(ICU_PTR(pat), ICU_LEN(pat), 
@@ -2652,7 +2893,7 @@ VALUE icu_ustr_search(argc, argv, str)
 	status = U_ZERO_ERROR;
 	if( usearch_first(search, &status) == USEARCH_DONE) {
 	   usearch_close(search);
-	   ucol_close(collator);
+	   icu_col_checkin(loc, attrs, collator);
 	   ubrk_close(brkit);
 	   return ret;
 	}
@@ -2669,13 +2910,13 @@ VALUE icu_ustr_search(argc, argv, str)
 	  if (lim > 0 && count >= lim) break;
 	} while (USEARCH_DONE != usearch_next(search, &status));
 	usearch_close( search);
-	ucol_close(collator);
+	icu_col_checkin(loc, attrs, collator);
 	ubrk_close(brkit);
 	return ret;
 
 failure:
         usearch_close( search);
-	ucol_close(collator);
+	icu_col_checkin(loc, attrs, collator);
 	ubrk_close(brkit);
 
 	rb_raise(rb_eArgError, u_errorName(status));
@@ -2893,11 +3134,11 @@ mirroring ICU class hierarchy.
 
 - regexps, matching and replacing: =~ ,  #match ,  #scan ,  #split ,  #sub ,  #sub! ,  #gsub ,  #gsub!  
 
-- conversion String/UString:  #to_s, Kernel#u, String#to_u
+- conversion String/UString:  #to_s, #write_to, #each_encoded_chunk, Kernel#u, String#to_u
 
 - iterators:  #each_line_break ,  #each_word ,  #each_char ,  #each_sentence 
 
-- split to chars/codepoints:  #chars ,  #codepoints , Array#to_u  
+- split to chars/codepoints:  #chars ,  #codepoints , #codepoints_packed , Array#to_u  
 
 - character case:   #upcase ,  #upcase! ,  #downcase ,  #downcase!  
 
@@ -2965,6 +3206,7 @@ mirroring ICU class hierarchy.
     rb_define_method(rb_cUString, "chars", icu_ustr_chars_m, -1);
     rb_define_method(rb_cUString, "char_span", icu_ustr_char_span, -1);
     rb_define_method(rb_cUString, "codepoints", icu_ustr_points, 0);
+    rb_define_method(rb_cUString, "codepoints_packed", icu_ustr_points_packed, 0);
 
     /* concat operations */
     rb_define_method(rb_cUString, "+", icu_ustr_plus, 1); 
@@ -3011,6 +3253,8 @@ mirroring ICU class hierarchy.
     rb_define_method(rb_cUString, "to_u", icu_ustr_to_ustr, -1);
     rb_define_method(rb_cUString, "to_s", icu_ustr_to_rstr, -1);
     rb_define_alias(rb_cUString, "to_str", "to_s");
+    rb_define_method(rb_cUString, "write_to", icu_ustr_write_to, -1);
+    rb_define_method(rb_cUString, "each_encoded_chunk", icu_ustr_each_encoded_chunk, -1);
 
     /* formatting messages */
     rb_define_method(rb_cUString, "format", icu_ustr_format, -2);